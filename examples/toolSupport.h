@@ -0,0 +1,174 @@
+#ifndef TXREF_EXAMPLES_TOOL_SUPPORT_H
+#define TXREF_EXAMPLES_TOOL_SUPPORT_H
+
+// Helpers shared by the POSIX command line tools in this directory.
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstddef>
+#include <cstring>
+#include <exception>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace tools {
+
+    // read-only memory mapping of a whole file. 'advice' is passed to madvise(), ex:
+    // MADV_SEQUENTIAL for a file that is read from start to end.
+    class MappedFile {
+    public:
+        explicit MappedFile(const std::string & path, int advice = MADV_NORMAL) {
+            fd_ = ::open(path.c_str(), O_RDONLY);
+            if(fd_ < 0)
+                throw std::runtime_error("can't open " + path + ": " + std::strerror(errno));
+            struct stat st {};
+            if(::fstat(fd_, &st) != 0) {
+                ::close(fd_);
+                throw std::runtime_error("can't stat " + path + ": " + std::strerror(errno));
+            }
+            size_ = static_cast<std::size_t>(st.st_size);
+            if(size_ > 0) {
+                void * addr = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd_, 0);
+                if(addr == MAP_FAILED) {
+                    ::close(fd_);
+                    throw std::runtime_error("can't map " + path + ": " + std::strerror(errno));
+                }
+                data_ = static_cast<const unsigned char *>(addr);
+                if(advice != MADV_NORMAL)
+                    ::madvise(addr, size_, advice);
+            }
+        }
+
+        ~MappedFile() {
+            if(data_ != nullptr)
+                ::munmap(const_cast<unsigned char *>(data_), size_);
+            ::close(fd_);
+        }
+
+        MappedFile(const MappedFile &) = delete;
+        MappedFile & operator=(const MappedFile &) = delete;
+
+        // the contents as text or as bytes. Null for an empty file.
+        const char * data() const { return reinterpret_cast<const char *>(data_); }
+        const unsigned char * bytes() const { return data_; }
+        std::size_t size() const { return size_; }
+
+    private:
+        int fd_ = -1;
+        const unsigned char * data_ = nullptr;
+        std::size_t size_ = 0;
+    };
+
+    // writes all of [data, data + size) to fd, retrying short writes
+    inline void writeAll(int fd, const void * data, std::size_t size) {
+        auto pos = static_cast<const char *>(data);
+        std::size_t remaining = size;
+        while(remaining > 0) {
+            ssize_t written = ::write(fd, pos, remaining);
+            if(written < 0) {
+                if(errno == EINTR)
+                    continue;
+                throw std::runtime_error(std::string("write failed: ") + std::strerror(errno));
+            }
+            pos += written;
+            remaining -= static_cast<std::size_t>(written);
+        }
+    }
+
+    inline void writeAll(int fd, const std::string & data) {
+        writeAll(fd, data.data(), data.size());
+    }
+
+    // calls produce(i) for each i in [0, count) on up to 'threads' worker threads, and
+    // consume(i, result) on the calling thread in order of i. Workers never get more than
+    // 2 * threads items ahead of consume(), which bounds memory use. If produce() or
+    // consume() throws, the workers stop and the first exception is rethrown once they
+    // have all finished.
+    template<typename Result, typename Produce, typename Consume>
+    void runOrdered(std::size_t count, unsigned int threads, Produce produce, Consume consume) {
+        const std::size_t window = 2 * static_cast<std::size_t>(std::max(1u, threads));
+        std::vector<Result> results(count);
+        std::vector<char> done(count, 0);
+        std::atomic<std::size_t> nextItem(0);
+        std::size_t consumed = 0;
+        bool failed = false;
+        std::exception_ptr error;
+        std::mutex mutex;
+        std::condition_variable cv;
+
+        auto fail = [&](std::exception_ptr e) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if(!failed)
+                error = e;
+            failed = true;
+            cv.notify_all();
+        };
+
+        auto worker = [&]() {
+            while(true) {
+                std::size_t i = nextItem++;
+                if(i >= count)
+                    return;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    cv.wait(lock, [&]() { return failed || i < consumed + window; });
+                    if(failed)
+                        return;
+                }
+                try {
+                    Result result = produce(i);
+                    std::lock_guard<std::mutex> lock(mutex);
+                    results[i] = std::move(result);
+                    done[i] = 1;
+                    cv.notify_all();
+                }
+                catch(...) {
+                    fail(std::current_exception());
+                    return;
+                }
+            }
+        };
+
+        std::vector<std::thread> workers;
+        for(std::size_t t = 0; t < std::min<std::size_t>(std::max(1u, threads), count); ++t)
+            workers.emplace_back(worker);
+
+        try {
+            for(std::size_t i = 0; i < count; ++i) {
+                Result result;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    cv.wait(lock, [&]() { return failed || done[i] != 0; });
+                    if(failed)
+                        break;
+                    result = std::move(results[i]);
+                }
+                consume(i, result);
+                std::lock_guard<std::mutex> lock(mutex);
+                consumed = i + 1;
+                cv.notify_all();
+            }
+        }
+        catch(...) {
+            fail(std::current_exception());
+        }
+
+        for(auto & thread : workers)
+            thread.join();
+        if(error)
+            std::rethrow_exception(error);
+    }
+
+}
+
+#endif // #ifndef TXREF_EXAMPLES_TOOL_SUPPORT_H
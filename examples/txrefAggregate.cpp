@@ -0,0 +1,243 @@
+#include "libtxref.h"
+#include "toolSupport.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+// Groups the txrefs in text files, one per line or in a tab-separated column, by block
+// height bucket, network and extended or not, and prints a count, distinct counts and
+// min/max values for each group. Each thread aggregates its own part of the input with a
+// txref::TxrefAggregator, and those are merged at the end, so memory use does not grow
+// with the size of the input.
+
+namespace {
+
+    using tools::MappedFile;
+
+    void usage(const char * name) {
+        std::cerr << "Usage: " << name << " [--bucket <heights>] [--column <n>] [--threads <n>] [<file>...]\n\n";
+        std::cerr << "Reads one txref per line, or with --column, the n-th (from 1) tab-separated field\n";
+        std::cerr << "of each line. Reads stdin if no files are given, or for '-'. Blank lines are\n";
+        std::cerr << "skipped. Prints one tab-separated line per group, ordered by height.\n\n";
+        std::cerr << "Options:\n";
+        std::cerr << "  --bucket <heights>   block heights per group (default: 2016, a difficulty period).\n";
+        std::cerr << "                       Each group and thread can take up to about 8 KB.\n";
+    }
+
+    struct Options {
+        int bucketSize = 2016;
+        int column = 0;            // 0 for the whole line
+        unsigned int threads = 0;
+        std::vector<std::string> files;
+    };
+
+    Options parseOptions(const std::vector<std::string> & args) {
+        Options options;
+        for(std::size_t i = 0; i < args.size(); ++i) {
+            const std::string & arg = args[i];
+            bool hasValue = i + 1 < args.size();
+            if(arg == "--bucket" && hasValue)
+                options.bucketSize = std::stoi(args[++i]);
+            else if(arg == "--column" && hasValue)
+                options.column = std::stoi(args[++i]);
+            else if(arg == "--threads" && hasValue)
+                options.threads = static_cast<unsigned int>(std::stoul(args[++i]));
+            else if(arg.size() > 1 && arg[0] == '-' && arg != "-")
+                throw std::runtime_error("unknown option: " + arg);
+            else
+                options.files.push_back(arg);
+        }
+        if(options.bucketSize < 1)
+            throw std::runtime_error("--bucket must be at least 1");
+        if(options.column < 0)
+            throw std::runtime_error("--column must be at least 1");
+        if(options.threads == 0)
+            options.threads = std::max(1u, std::thread::hardware_concurrency());
+        if(options.files.empty())
+            options.files.push_back("-");
+        return options;
+    }
+
+    bool isTrailingSpace(char c) {
+        return c == '\r' || c == ' ' || c == '\t';
+    }
+
+    // adds the txref on each line in [begin, end), without copying it. Blank lines are
+    // skipped; a line without the requested column is counted as invalid.
+    void aggregateLines(const char * begin, const char * end, int column, txref::TxrefAggregator & aggregator) {
+        while(begin < end) {
+            auto newline = static_cast<const char *>(std::memchr(begin, '\n', static_cast<std::size_t>(end - begin)));
+            const char * lineEnd = newline == nullptr ? end : newline;
+            const char * field = begin;
+            begin = newline == nullptr ? end : newline + 1;
+
+            while(lineEnd > field && isTrailingSpace(lineEnd[-1]))
+                --lineEnd;
+            if(lineEnd == field)
+                continue;
+            const char * fieldEnd = lineEnd;
+
+            if(column > 0) {
+                for(int c = 1; c < column && field != nullptr; ++c) {
+                    auto tab = static_cast<const char *>(std::memchr(field, '\t', static_cast<std::size_t>(lineEnd - field)));
+                    field = tab == nullptr ? nullptr : tab + 1;
+                }
+                if(field == nullptr) {
+                    aggregator.add(nullptr, 0);
+                    continue;
+                }
+                auto tab = static_cast<const char *>(std::memchr(field, '\t', static_cast<std::size_t>(lineEnd - field)));
+                fieldEnd = tab == nullptr ? lineEnd : tab;
+            }
+
+            while(fieldEnd > field && isTrailingSpace(fieldEnd[-1]))
+                --fieldEnd;
+            aggregator.add(field, static_cast<std::size_t>(fieldEnd - field));
+        }
+    }
+
+    // below this size, a buffer isn't worth starting threads for
+    const std::size_t PARALLEL_MIN_SIZE = 1u << 20u;
+
+    // splits [data, data + size), which ends at a line boundary, into one part per
+    // aggregator and aggregates the parts in parallel
+    void aggregateBuffer(const char * data, std::size_t size, int column,
+                         std::vector<txref::TxrefAggregator> & aggregators) {
+        std::size_t parts = size < PARALLEL_MIN_SIZE ? 1 : aggregators.size();
+        std::vector<const char *> bounds(1, data);
+        for(std::size_t t = 1; t < parts; ++t) {
+            const char * pos = std::max(bounds.back(), data + size / parts * t);
+            auto newline = static_cast<const char *>(std::memchr(pos, '\n', static_cast<std::size_t>(data + size - pos)));
+            bounds.push_back(newline == nullptr ? data + size : newline + 1);
+        }
+        bounds.push_back(data + size);
+
+        std::vector<std::thread> workers;
+        for(std::size_t i = 1; i < parts; ++i)
+            workers.emplace_back(aggregateLines, bounds[i], bounds[i + 1], column, std::ref(aggregators[i]));
+        aggregateLines(bounds[0], bounds[1], column, aggregators[0]);
+        for(auto & worker : workers)
+            worker.join();
+    }
+
+    // reads stdin in large blocks, and aggregates the complete lines of each block
+    void aggregateStdin(int column, std::vector<txref::TxrefAggregator> & aggregators) {
+        const std::size_t blockSize = 64u << 20u;
+        std::vector<char> buffer(blockSize);
+        std::size_t filled = 0;
+        for(;;) {
+            if(filled == buffer.size())
+                buffer.resize(buffer.size() * 2);   // a line longer than a block
+            ssize_t n = ::read(STDIN_FILENO, buffer.data() + filled, buffer.size() - filled);
+            if(n < 0) {
+                if(errno == EINTR)
+                    continue;
+                throw std::runtime_error(std::string("can't read stdin: ") + std::strerror(errno));
+            }
+            if(n == 0)
+                break;
+            filled += static_cast<std::size_t>(n);
+
+            // keep an incomplete last line for the next block
+            std::size_t complete = filled;
+            while(complete > 0 && buffer[complete - 1] != '\n')
+                --complete;
+            if(complete == 0)
+                continue;
+            aggregateBuffer(buffer.data(), complete, column, aggregators);
+            std::memmove(buffer.data(), buffer.data() + complete, filled - complete);
+            filled -= complete;
+        }
+        aggregateBuffer(buffer.data(), filled, column, aggregators);
+    }
+
+    std::string networkName(int magicCode) {
+        switch(magicCode) {
+            case txref::MAGIC_CODE_MAIN:
+                return "main";
+            case txref::MAGIC_CODE_TEST:
+                return "test";
+            case txref::MAGIC_CODE_REGTEST:
+                return "regtest";
+            default:
+                return std::to_string(magicCode);
+        }
+    }
+
+    void printGroups(const std::vector<txref::TxrefGroup> & groups) {
+        std::cout << "first_height\tnetwork\textended\tcount\tdistinct_transactions\tdistinct_outputs\t"
+                     "min_height\tmax_height\tmin_transaction_index\tmax_transaction_index\t"
+                     "min_txo_index\tmax_txo_index\ttxo_histogram\n";
+        for(const auto & group : groups) {
+            std::cout << group.firstHeight << '\t' << networkName(group.magicCode) << '\t'
+                      << (group.extended ? "yes" : "no") << '\t' << group.count << '\t'
+                      << group.distinctTransactions << '\t' << group.distinctOutputs << '\t'
+                      << group.minHeight << '\t' << group.maxHeight << '\t'
+                      << group.minTransactionIndex << '\t' << group.maxTransactionIndex << '\t'
+                      << group.minTxoIndex << '\t' << group.maxTxoIndex << '\t';
+            if(group.extended) {
+                // trailing empty buckets are left out
+                std::size_t used = 16;
+                while(used > 1 && group.txoHistogram[used - 1] == 0)
+                    --used;
+                for(std::size_t i = 0; i < used; ++i)
+                    std::cout << (i == 0 ? "" : ",") << group.txoHistogram[i];
+            }
+            else {
+                std::cout << '-';
+            }
+            std::cout << '\n';
+        }
+    }
+
+}
+
+int main(int argc, char* argv[])
+{
+    Options options;
+    try {
+        options = parseOptions(std::vector<std::string>(argv + 1, argv + argc));
+    }
+    catch(const std::exception & e) {
+        std::cerr << e.what() << "\n\n";
+        usage(argv[0]);
+        return 1;
+    }
+
+    try {
+        std::vector<txref::TxrefAggregator> aggregators;
+        for(unsigned int t = 0; t < options.threads; ++t)
+            aggregators.emplace_back(options.bucketSize);
+
+        for(const auto & path : options.files) {
+            if(path == "-") {
+                aggregateStdin(options.column, aggregators);
+                continue;
+            }
+            MappedFile file(path, MADV_SEQUENTIAL);
+            aggregateBuffer(file.data(), file.size(), options.column, aggregators);
+        }
+
+        for(std::size_t t = 1; t < aggregators.size(); ++t)
+            aggregators[0].merge(aggregators[t]);
+        printGroups(aggregators[0].groups());
+
+        if(aggregators[0].invalidCount() > 0)
+            std::cerr << aggregators[0].invalidCount() << " line(s) did not have a valid txref\n";
+    }
+    catch(const std::exception & e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
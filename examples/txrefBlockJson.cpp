@@ -0,0 +1,475 @@
+#include "libtxref.h"
+#include "toolSupport.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Turns archived `bitcoin-cli getblock <hash> 2` (or verbosity 1) JSON dumps into
+// txid -> txref mappings, and with --outputs also txid:vout -> txref-ext mappings. Only
+// the block's height, the ordered tx[].txid values and the number of vout entries are
+// read; everything else is skipped without being parsed. Files are scanned in parallel
+// and the output is written in the order the files were given. A file may hold several
+// blocks, one after the other, and each may be wrapped in a JSON-RPC response.
+
+namespace {
+
+    using tools::MappedFile;
+    using tools::writeAll;
+
+    struct Options {
+        bool outputs = false;
+        int magicCode = txref::MAGIC_CODE_MAIN;
+        int magicCodeExtended = txref::MAGIC_CODE_MAIN_EXTENDED;
+        txref::Style style = txref::Style::pretty;
+        unsigned int threads = 0;
+        std::string output;
+        std::vector<std::string> inputs;
+    };
+
+    void usage(const char * name) {
+        std::cerr << "Usage:\n";
+        std::cerr << name << " [options] <output> <getblock.json>...\n\n";
+        std::cerr << "Writes one \"<txid>\\t<txref>\" line per transaction to <output> ('-' for stdout).\n\n";
+        std::cerr << "Options:\n";
+        std::cerr << "  --outputs                 also write a \"<txid>:<vout>\\t<txref-ext>\" line per output\n";
+        std::cerr << "  --network main|test|regtest  network of the blocks (default: main)\n";
+        std::cerr << "  --compact                 write compact txrefs, without separators\n";
+        std::cerr << "  --threads <n>             worker threads (default: number of cores)\n";
+    }
+
+    Options parseOptions(int argc, char * argv[]) {
+        Options options;
+        std::vector<std::string> positional;
+
+        for(int i = 1; i < argc; ++i) {
+            std::string arg = argv[i];
+            bool hasValue = i + 1 < argc;
+            if(arg == "--outputs") {
+                options.outputs = true;
+            }
+            else if(arg == "--compact") {
+                options.style = txref::Style::compact;
+            }
+            else if(arg == "--network" && hasValue) {
+                std::string network = argv[++i];
+                if(network == "main") {
+                    options.magicCode = txref::MAGIC_CODE_MAIN;
+                    options.magicCodeExtended = txref::MAGIC_CODE_MAIN_EXTENDED;
+                }
+                else if(network == "test") {
+                    options.magicCode = txref::MAGIC_CODE_TEST;
+                    options.magicCodeExtended = txref::MAGIC_CODE_TEST_EXTENDED;
+                }
+                else if(network == "regtest") {
+                    options.magicCode = txref::MAGIC_CODE_REGTEST;
+                    options.magicCodeExtended = txref::MAGIC_CODE_REGTEST_EXTENDED;
+                }
+                else
+                    throw std::runtime_error("unknown network: " + network);
+            }
+            else if(arg == "--threads" && hasValue) {
+                options.threads = static_cast<unsigned int>(std::stoul(argv[++i]));
+            }
+            else if(arg.length() > 1 && arg[0] == '-') {
+                throw std::runtime_error("unknown or incomplete option: " + arg);
+            }
+            else {
+                positional.push_back(arg);
+            }
+        }
+        if(positional.size() < 2)
+            throw std::runtime_error("missing arguments");
+        options.output = positional[0];
+        options.inputs.assign(positional.begin() + 1, positional.end());
+        if(options.threads == 0)
+            options.threads = std::max(1u, std::thread::hardware_concurrency());
+        return options;
+    }
+
+    // a range of chars within the input
+    struct Field {
+        const char * begin = nullptr;
+        const char * end = nullptr;
+
+        bool equals(const char * str) const {
+            std::size_t length = std::strlen(str);
+            return static_cast<std::size_t>(end - begin) == length && std::equal(begin, end, str);
+        }
+    };
+
+    // what's kept from each transaction of a block
+    struct Transaction {
+        Field txid;
+        std::size_t outputCount = 0;
+        bool hasOutputs = false;  // only verbosity 2 lists the outputs
+    };
+
+    struct Block {
+        int height = -1;
+        bool hasTransactions = false;
+        std::vector<Transaction> transactions;
+    };
+
+    // a forward-only scanner over the JSON text of getblock output. Nothing is copied or
+    // unescaped; values the caller doesn't ask for are skipped.
+    class Scanner {
+    public:
+        Scanner(const char * begin, const char * end) : begin_(begin), pos_(begin), end_(end) {}
+
+        bool atEnd() {
+            skipWhitespace();
+            return pos_ == end_;
+        }
+
+        char peek() {
+            skipWhitespace();
+            if(pos_ == end_)
+                fail("unexpected end of input");
+            return *pos_;
+        }
+
+        void expect(char c) {
+            if(peek() != c)
+                fail(std::string("expected '") + c + "'");
+            ++pos_;
+        }
+
+        // consumes c if it is the next char
+        bool accept(char c) {
+            if(peek() != c)
+                return false;
+            ++pos_;
+            return true;
+        }
+
+        // the contents of a string, without its quotes
+        Field readString() {
+            expect('"');
+            Field field;
+            field.begin = pos_;
+            pos_ = findStringEnd(pos_, end_);
+            if(pos_ == end_)
+                fail("unterminated string");
+            field.end = pos_++;
+            return field;
+        }
+
+        int readInt() {
+            skipWhitespace();
+            const char * digits = pos_;
+            long value = 0;
+            while(pos_ < end_ && *pos_ >= '0' && *pos_ <= '9') {
+                value = value * 10 + (*pos_ - '0');
+                if(value > 0x7FFFFFFF)
+                    fail("number is too large");
+                ++pos_;
+            }
+            if(pos_ == digits)
+                fail("expected a non-negative integer");
+            return static_cast<int>(value);
+        }
+
+        // skips any value: string, number, literal, object or array
+        void skipValue() {
+            char c = peek();
+            if(c == '"') {
+                readString();
+                return;
+            }
+            if(c != '{' && c != '[') {
+                while(pos_ < end_ && *pos_ != ',' && *pos_ != '}' && *pos_ != ']' && !isWhitespace(*pos_))
+                    ++pos_;
+                return;
+            }
+
+            // nested values only need their brackets balanced, with strings skipped whole
+            int depth = 0;
+            while(pos_ < end_) {
+                c = *pos_;
+                if(c == '"') {
+                    pos_ = findStringEnd(pos_ + 1, end_);
+                    if(pos_ == end_)
+                        break;
+                }
+                else if(c == '{' || c == '[') {
+                    ++depth;
+                }
+                else if(c == '}' || c == ']') {
+                    if(--depth == 0) {
+                        ++pos_;
+                        return;
+                    }
+                }
+                ++pos_;
+            }
+            fail("unterminated object or array");
+        }
+
+        [[noreturn]] void fail(const std::string & message) const {
+            throw std::runtime_error(message + " at offset " + std::to_string(pos_ - begin_));
+        }
+
+    private:
+        static bool isWhitespace(char c) {
+            return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+        }
+
+        void skipWhitespace() {
+            while(pos_ < end_ && isWhitespace(*pos_))
+                ++pos_;
+        }
+
+        // the closing quote of the string whose contents start at pos, or end if there is
+        // none. Most of a verbose block is long hex strings, so this looks at 16 chars at a
+        // time where it can.
+        static const char * findStringEnd(const char * pos, const char * end) {
+#if defined(__SSE2__)
+            const __m128i quote = _mm_set1_epi8('"');
+            const __m128i backslash = _mm_set1_epi8('\\');
+            while(end - pos >= 16) {
+                __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pos));
+                int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(chunk, quote),
+                                                          _mm_cmpeq_epi8(chunk, backslash)));
+                if(mask == 0) {
+                    pos += 16;
+                    continue;
+                }
+                pos += __builtin_ctz(static_cast<unsigned int>(mask));
+                if(*pos == '"')
+                    return pos;
+                if(end - pos < 2)
+                    return end;
+                pos += 2; // escaped char
+            }
+#endif
+            while(pos < end) {
+                if(*pos == '"')
+                    return pos;
+                if(*pos == '\\' && end - pos < 2)
+                    return end;
+                pos += (*pos == '\\') ? 2 : 1;
+            }
+            return end;
+        }
+
+        const char * begin_;
+        const char * pos_;
+        const char * end_;
+    };
+
+    // the number of elements in an array, skipping each of them
+    std::size_t countElements(Scanner & scanner) {
+        std::size_t count = 0;
+        scanner.expect('[');
+        if(scanner.accept(']'))
+            return 0;
+        do {
+            scanner.skipValue();
+            ++count;
+        } while(scanner.accept(','));
+        scanner.expect(']');
+        return count;
+    }
+
+    // one element of tx[]: a txid string (verbosity 1) or a transaction object (verbosity 2)
+    Transaction readTransaction(Scanner & scanner) {
+        Transaction tx;
+        if(scanner.peek() == '"') {
+            tx.txid = scanner.readString();
+        }
+        else {
+            scanner.expect('{');
+            if(!scanner.accept('}')) {
+                do {
+                    Field key = scanner.readString();
+                    scanner.expect(':');
+                    if(key.equals("txid"))
+                        tx.txid = scanner.readString();
+                    else if(key.equals("vout")) {
+                        tx.outputCount = countElements(scanner);
+                        tx.hasOutputs = true;
+                    }
+                    else
+                        scanner.skipValue();
+                } while(scanner.accept(','));
+                scanner.expect('}');
+            }
+        }
+        // the same check for a bare txid (verbosity 1) and a transaction object (verbosity 2)
+        if(static_cast<int>(tx.txid.end - tx.txid.begin) != txref::limits::TXID_LENGTH
+           || !txref::parseTxid(std::string(tx.txid.begin, tx.txid.end)))
+            scanner.fail("transaction without a valid txid");
+        return tx;
+    }
+
+    // a getblock object, or a JSON-RPC response with one in its "result"
+    void readBlock(Scanner & scanner, Block & block) {
+        scanner.expect('{');
+        if(scanner.accept('}'))
+            return;
+        do {
+            Field key = scanner.readString();
+            scanner.expect(':');
+            if(key.equals("height")) {
+                block.height = scanner.readInt();
+            }
+            else if(key.equals("tx")) {
+                block.hasTransactions = true;
+                scanner.expect('[');
+                if(!scanner.accept(']')) {
+                    do {
+                        block.transactions.push_back(readTransaction(scanner));
+                    } while(scanner.accept(','));
+                    scanner.expect(']');
+                }
+            }
+            else if(key.equals("result") && scanner.peek() == '{') {
+                readBlock(scanner, block);
+            }
+            else {
+                scanner.skipValue();
+            }
+        } while(scanner.accept(','));
+        scanner.expect('}');
+    }
+
+    void appendTxref(std::string & out, const txref::Coordinates & coordinates, txref::Style style) {
+        char buffer[txref::limits::TXREF_MAX_LENGTH];
+        std::size_t length = txref::encodeTo(buffer, sizeof(buffer), coordinates, style);
+        out.append(buffer, length);
+    }
+
+    void appendBlock(const Options & options, const Block & block, std::string & out) {
+        for(std::size_t i = 0; i < block.transactions.size(); ++i) {
+            const Transaction & tx = block.transactions[i];
+            auto transactionIndex = static_cast<int>(i);
+
+            out.append(tx.txid.begin, tx.txid.end);
+            out += '\t';
+            appendTxref(out, txref::Coordinates(block.height, transactionIndex, 0, options.magicCode),
+                        options.style);
+            out += '\n';
+
+            if(!options.outputs)
+                continue;
+            for(std::size_t vout = 0; vout < tx.outputCount; ++vout) {
+                out.append(tx.txid.begin, tx.txid.end);
+                out += ':';
+                out += std::to_string(vout);
+                out += '\t';
+                appendTxref(out, txref::Coordinates(block.height, transactionIndex, static_cast<int>(vout),
+                                                    options.magicCodeExtended), options.style);
+                out += '\n';
+            }
+        }
+    }
+
+    // scans every block in a file and returns its output lines
+    std::string convertFile(const Options & options, const std::string & path) {
+        MappedFile input(path, MADV_SEQUENTIAL);
+        Scanner scanner(input.data(), input.data() + input.size());
+        std::string out;
+        Block block;
+        try {
+            while(!scanner.atEnd()) {
+                block.height = -1;
+                block.hasTransactions = false;
+                block.transactions.clear();
+                readBlock(scanner, block);
+                if(block.height < 0 || !block.hasTransactions)
+                    scanner.fail("object is not a getblock result with height and tx");
+                if(options.outputs)
+                    for(const auto & tx : block.transactions)
+                        if(!tx.hasOutputs)
+                            scanner.fail("--outputs needs getblock verbosity 2");
+                appendBlock(options, block, out);
+            }
+        }
+        catch(const std::exception & e) {
+            throw std::runtime_error(path + ": " + e.what());
+        }
+        return out;
+    }
+
+    // the output of one file, or why it couldn't be converted
+    struct FileResult {
+        std::string output;
+        std::string error;
+    };
+
+    int run(const Options & options) {
+        int out = STDOUT_FILENO;
+        if(options.output != "-") {
+            out = ::open(options.output.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if(out < 0)
+                throw std::runtime_error("can't open " + options.output + ": " + std::strerror(errno));
+        }
+
+        // workers convert files in any order, but the output is written in the order the
+        // files were given. A file that can't be read or scanned is reported and skipped;
+        // the others are still written
+        int status = 0;
+        try {
+            tools::runOrdered<FileResult>(options.inputs.size(), options.threads, [&](std::size_t i) {
+                FileResult result;
+                try {
+                    result.output = convertFile(options, options.inputs[i]);
+                }
+                catch(const std::exception & e) {
+                    result.error = e.what();
+                }
+                return result;
+            }, [&](std::size_t, const FileResult & result) {
+                if(!result.error.empty()) {
+                    std::cerr << result.error << "\n";
+                    status = 1;
+                }
+                writeAll(out, result.output);
+            });
+        }
+        catch(const std::exception & e) {
+            std::cerr << e.what() << "\n";
+            status = 1;
+        }
+
+        if(out != STDOUT_FILENO)
+            ::close(out);
+        return status;
+    }
+
+}
+
+int main(int argc, char* argv[])
+{
+    Options options;
+    try {
+        options = parseOptions(argc, argv);
+    }
+    catch(const std::exception & e) {
+        std::cerr << e.what() << "\n\n";
+        usage(argv[0]);
+        return 1;
+    }
+
+    try {
+        return run(options);
+    }
+    catch(const std::exception & e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,117 @@
+#include "libtxref.h"
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Decodes a very large file of txrefs, one per line, with txref::decodeFile(): reads go
+// through io_uring (or pread) in large blocks, optionally with O_DIRECT, while worker
+// threads decode. Prints the coordinates of each line, in order.
+
+namespace {
+
+    void usage(const char * name) {
+        std::cerr << "Usage: " << name << " [options] <file>\n\n";
+        std::cerr << "Prints \"blockHeight<TAB>transactionIndex<TAB>txoIndex<TAB>magicCode\" for each line,\n";
+        std::cerr << "or \"-\" for a line that is not a txref. Options:\n";
+        std::cerr << "  --threads <n>      decoding threads (default: one per core)\n";
+        std::cerr << "  --read-size <KiB>  bytes per read (default: 4096 KiB)\n";
+        std::cerr << "  --reads <n>        reads in flight with io_uring (default: 4)\n";
+        std::cerr << "  --direct           read with O_DIRECT, bypassing the page cache\n";
+        std::cerr << "  --no-io-uring      read with pread() even if io_uring is available\n";
+        std::cerr << "  --count            only print the totals\n";
+    }
+
+    void appendNumber(std::string & out, int value) {
+        char digits[16];
+        int n = 0;
+        auto v = static_cast<unsigned int>(value);
+        do {
+            digits[n++] = static_cast<char>('0' + v % 10);
+            v /= 10;
+        } while(v != 0);
+        while(n > 0)
+            out.push_back(digits[--n]);
+    }
+
+}
+
+int main(int argc, char* argv[])
+{
+    txref::FileDecodeOptions options;
+    bool countOnly = false;
+    std::string path;
+
+    try {
+        std::vector<std::string> args(argv + 1, argv + argc);
+        for(std::size_t i = 0; i < args.size(); ++i) {
+            const std::string & arg = args[i];
+            bool hasValue = i + 1 < args.size();
+            if(arg == "--threads" && hasValue)
+                options.threads = static_cast<unsigned int>(std::stoul(args[++i]));
+            else if(arg == "--read-size" && hasValue)
+                options.readSize = static_cast<std::size_t>(std::stoul(args[++i])) * 1024;
+            else if(arg == "--reads" && hasValue)
+                options.readsInFlight = static_cast<unsigned int>(std::stoul(args[++i]));
+            else if(arg == "--direct")
+                options.directIo = true;
+            else if(arg == "--no-io-uring")
+                options.ioUring = false;
+            else if(arg == "--count")
+                countOnly = true;
+            else if(path.empty() && (arg.empty() || arg[0] != '-'))
+                path = arg;
+            else
+                throw std::runtime_error("unknown option: " + arg);
+        }
+        if(path.empty())
+            throw std::runtime_error("missing file");
+    }
+    catch(const std::exception & e) {
+        std::cerr << e.what() << "\n\n";
+        usage(argv[0]);
+        return 1;
+    }
+
+    try {
+        std::string out;
+        auto start = std::chrono::steady_clock::now();
+        auto stats = txref::decodeFile(path, [&](std::uint64_t, const txref::DecodedLine * lines, std::size_t count) {
+            if(countOnly)
+                return;
+            out.clear();
+            for(std::size_t i = 0; i < count; ++i) {
+                const txref::Coordinates & c = lines[i].coordinates;
+                if(!lines[i].valid) {
+                    out += "-\n";
+                    continue;
+                }
+                appendNumber(out, c.blockHeight);
+                out.push_back('\t');
+                appendNumber(out, c.transactionIndex);
+                out.push_back('\t');
+                appendNumber(out, c.txoIndex);
+                out.push_back('\t');
+                appendNumber(out, c.magicCode);
+                out.push_back('\n');
+            }
+            if(std::fwrite(out.data(), 1, out.size(), stdout) != out.size())
+                throw std::runtime_error("write failed");
+        }, options);
+        if(std::fflush(stdout) != 0)
+            throw std::runtime_error("write failed");
+
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::cerr << stats.lines << " lines, " << stats.invalidLines << " not txrefs, "
+                  << stats.bytes / 1048576 << " MiB in " << seconds << " s ("
+                  << (stats.usedIoUring ? "io_uring" : "pread") << (stats.usedDirectIo ? ", O_DIRECT" : "") << ")\n";
+    }
+    catch(const std::exception & e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
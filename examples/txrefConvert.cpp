@@ -0,0 +1,664 @@
+#include "libtxref.h"
+#include "toolSupport.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// Adds a txref column next to height/index columns (or the reverse) in large CSV, TSV
+// or NDJSON files. The input is memory-mapped and split into chunks at record
+// boundaries, the chunks are converted in parallel, and the output is written in the
+// original order. Every output row gets an error column. With --checkpoint, progress is
+// recorded after each chunk so an interrupted run can be resumed.
+
+namespace {
+
+    using tools::MappedFile;
+    using tools::writeAll;
+
+    enum class Format { csv, tsv, ndjson };
+
+    enum class Mode { encode, decode };
+
+    struct Options {
+        Format format = Format::csv;
+        bool formatGiven = false;
+        Mode mode = Mode::encode;
+        std::vector<std::string> columns;
+        int magicCode = txref::MAGIC_CODE_MAIN;
+        int magicCodeExtended = txref::MAGIC_CODE_MAIN_EXTENDED;
+        unsigned int threads = 0;
+        std::size_t chunkSize = 8 * 1024 * 1024;
+        std::string input;
+        std::string output;
+        std::string checkpoint;
+    };
+
+    // a range of chars within the input
+    struct Field {
+        const char * begin = nullptr;
+        const char * end = nullptr;
+
+        bool empty() const { return begin == end; }
+    };
+
+    // where each column to convert lives: an index for CSV/TSV, a key for NDJSON
+    struct ColumnRefs {
+        std::vector<std::size_t> indexes;
+        std::vector<std::string> keys;
+    };
+
+    void usage(const char * name) {
+        std::cerr << "Usage:\n";
+        std::cerr << name << " [options] --encode <heightColumn>,<indexColumn>[,<txoColumn>] <input> <output>\n";
+        std::cerr << "or\n";
+        std::cerr << name << " [options] --decode <txrefColumn> <input> <output>\n\n";
+        std::cerr << "<output> may be '-' for stdout, except with --checkpoint.\n\n";
+        std::cerr << "Options:\n";
+        std::cerr << "  --format csv|tsv|ndjson   input format (default: from file extension)\n";
+        std::cerr << "  --network main|test|regtest  network used when encoding (default: main)\n";
+        std::cerr << "  --threads <n>             worker threads (default: number of cores)\n";
+        std::cerr << "  --chunk-size <MiB>        size of the chunks converted by each worker (default: 8)\n";
+        std::cerr << "  --checkpoint <file>       record progress in <file> and resume from it if it exists\n";
+    }
+
+    std::vector<std::string> splitList(const std::string & list) {
+        std::vector<std::string> items;
+        std::string::size_type start = 0;
+        while(true) {
+            auto comma = list.find(',', start);
+            items.push_back(list.substr(start, comma - start));
+            if(comma == std::string::npos)
+                break;
+            start = comma + 1;
+        }
+        return items;
+    }
+
+    bool endsWith(const std::string & str, const std::string & suffix) {
+        return str.length() >= suffix.length() &&
+               str.compare(str.length() - suffix.length(), suffix.length(), suffix) == 0;
+    }
+
+    Options parseOptions(int argc, char * argv[]) {
+        Options options;
+        std::vector<std::string> positional;
+        bool modeGiven = false;
+
+        for(int i = 1; i < argc; ++i) {
+            std::string arg = argv[i];
+            bool hasValue = i + 1 < argc;
+            if(arg == "--encode" && hasValue) {
+                options.mode = Mode::encode;
+                options.columns = splitList(argv[++i]);
+                modeGiven = true;
+            }
+            else if(arg == "--decode" && hasValue) {
+                options.mode = Mode::decode;
+                options.columns = splitList(argv[++i]);
+                modeGiven = true;
+            }
+            else if(arg == "--format" && hasValue) {
+                std::string format = argv[++i];
+                if(format == "csv")
+                    options.format = Format::csv;
+                else if(format == "tsv")
+                    options.format = Format::tsv;
+                else if(format == "ndjson")
+                    options.format = Format::ndjson;
+                else
+                    throw std::runtime_error("unknown format: " + format);
+                options.formatGiven = true;
+            }
+            else if(arg == "--network" && hasValue) {
+                std::string network = argv[++i];
+                if(network == "main") {
+                    options.magicCode = txref::MAGIC_CODE_MAIN;
+                    options.magicCodeExtended = txref::MAGIC_CODE_MAIN_EXTENDED;
+                }
+                else if(network == "test") {
+                    options.magicCode = txref::MAGIC_CODE_TEST;
+                    options.magicCodeExtended = txref::MAGIC_CODE_TEST_EXTENDED;
+                }
+                else if(network == "regtest") {
+                    options.magicCode = txref::MAGIC_CODE_REGTEST;
+                    options.magicCodeExtended = txref::MAGIC_CODE_REGTEST_EXTENDED;
+                }
+                else
+                    throw std::runtime_error("unknown network: " + network);
+            }
+            else if(arg == "--threads" && hasValue) {
+                options.threads = static_cast<unsigned int>(std::stoul(argv[++i]));
+            }
+            else if(arg == "--chunk-size" && hasValue) {
+                options.chunkSize = std::stoul(argv[++i]) * 1024 * 1024;
+            }
+            else if(arg == "--checkpoint" && hasValue) {
+                options.checkpoint = argv[++i];
+            }
+            else if(arg.size() > 1 && arg[0] == '-') {
+                throw std::runtime_error("unknown or incomplete option: " + arg);
+            }
+            else {
+                positional.push_back(arg);
+            }
+        }
+
+        if(!modeGiven || positional.size() != 2)
+            throw std::runtime_error("missing arguments");
+        if(options.mode == Mode::encode && (options.columns.size() < 2 || options.columns.size() > 3))
+            throw std::runtime_error("--encode needs 2 or 3 column names");
+        if(options.mode == Mode::decode && options.columns.size() != 1)
+            throw std::runtime_error("--decode needs 1 column name");
+
+        options.input = positional[0];
+        options.output = positional[1];
+        if(options.output == "-" && !options.checkpoint.empty())
+            throw std::runtime_error("--checkpoint needs an output file");
+
+        if(!options.formatGiven) {
+            if(endsWith(options.input, ".tsv"))
+                options.format = Format::tsv;
+            else if(endsWith(options.input, ".ndjson") || endsWith(options.input, ".jsonl"))
+                options.format = Format::ndjson;
+        }
+        if(options.threads == 0)
+            options.threads = std::max(1u, std::thread::hardware_concurrency());
+        if(options.chunkSize == 0)
+            options.chunkSize = 1024 * 1024;
+
+        return options;
+    }
+
+    // end of the record starting at pos, not including the '\n' (or '\r\n')
+    const char * recordEnd(const char * pos, const char * end, const char ** next) {
+        auto newline = static_cast<const char *>(std::memchr(pos, '\n', static_cast<std::size_t>(end - pos)));
+        *next = newline == nullptr ? end : newline + 1;
+        const char * recEnd = newline == nullptr ? end : newline;
+        if(recEnd > pos && recEnd[-1] == '\r')
+            --recEnd;
+        return recEnd;
+    }
+
+    // splits a CSV/TSV record into fields. Quotes around a field are removed; quoted
+    // fields may contain the delimiter but not a newline.
+    void splitRecord(const char * begin, const char * end, char delimiter, std::vector<Field> & fields) {
+        fields.clear();
+        const char * pos = begin;
+        while(true) {
+            Field field;
+            if(pos < end && *pos == '"') {
+                field.begin = ++pos;
+                while(pos < end && !(*pos == '"' && (pos + 1 == end || pos[1] != '"')))
+                    pos += (*pos == '"') ? 2 : 1;
+                field.end = pos;
+                if(pos < end)
+                    ++pos; // closing quote
+                while(pos < end && *pos != delimiter)
+                    ++pos;
+            }
+            else {
+                field.begin = pos;
+                while(pos < end && *pos != delimiter)
+                    ++pos;
+                field.end = pos;
+            }
+            fields.push_back(field);
+            if(pos >= end)
+                break;
+            ++pos; // delimiter
+        }
+    }
+
+    // finds the value of a top-level key in a JSON object. String values are returned
+    // without their quotes. Nested objects and arrays are skipped, not searched.
+    bool findJsonValue(const char * begin, const char * end, const std::string & key, Field & value) {
+        int depth = 0;
+        const char * pos = begin;
+        while(pos < end) {
+            char c = *pos;
+            if(c == '"') {
+                const char * strBegin = ++pos;
+                while(pos < end && *pos != '"')
+                    pos += (*pos == '\\') ? 2 : 1;
+                if(pos >= end)
+                    return false;
+                const char * strEnd = pos++;
+                if(depth != 1)
+                    continue;
+                // is this string a key?
+                const char * colon = pos;
+                while(colon < end && (*colon == ' ' || *colon == '\t'))
+                    ++colon;
+                if(colon >= end || *colon != ':')
+                    continue;
+                bool match = static_cast<std::size_t>(strEnd - strBegin) == key.length() &&
+                             std::equal(strBegin, strEnd, key.begin());
+                pos = colon + 1;
+                if(!match)
+                    continue;
+                while(pos < end && (*pos == ' ' || *pos == '\t'))
+                    ++pos;
+                if(pos < end && *pos == '"') {
+                    value.begin = ++pos;
+                    while(pos < end && *pos != '"')
+                        pos += (*pos == '\\') ? 2 : 1;
+                    value.end = std::min(pos, end);
+                }
+                else {
+                    value.begin = pos;
+                    while(pos < end && *pos != ',' && *pos != '}' && *pos != ' ' && *pos != '\t')
+                        ++pos;
+                    value.end = pos;
+                }
+                return true;
+            }
+            if(c == '{' || c == '[')
+                ++depth;
+            else if(c == '}' || c == ']')
+                --depth;
+            ++pos;
+        }
+        return false;
+    }
+
+    bool parseInt(const Field & field, int & value) {
+        const char * pos = field.begin;
+        while(pos < field.end && (*pos == ' ' || *pos == '\t'))
+            ++pos;
+        if(pos == field.end)
+            return false;
+        bool negative = false;
+        if(*pos == '-') {
+            negative = true;
+            ++pos;
+        }
+        long result = 0;
+        const char * digits = pos;
+        while(pos < field.end && *pos >= '0' && *pos <= '9') {
+            result = result * 10 + (*pos - '0');
+            if(result > 0x7FFFFFFF)
+                return false;
+            ++pos;
+        }
+        while(pos < field.end && (*pos == ' ' || *pos == '\t'))
+            ++pos;
+        if(pos == digits || pos != field.end)
+            return false;
+        value = static_cast<int>(negative ? -result : result);
+        return true;
+    }
+
+    // appends an error message as a CSV/TSV field or a JSON string body
+    void appendEscaped(std::string & out, const std::string & text, Format format) {
+        if(format == Format::ndjson) {
+            for(char c : text) {
+                if(c == '"' || c == '\\')
+                    out += '\\';
+                out += c;
+            }
+            return;
+        }
+        char delimiter = format == Format::tsv ? '\t' : ',';
+        if(text.find_first_of(std::string("\"\n") + delimiter) == std::string::npos) {
+            out += text;
+            return;
+        }
+        out += '"';
+        for(char c : text) {
+            if(c == '"')
+                out += '"';
+            out += c == '\n' ? ' ' : c;
+        }
+        out += '"';
+    }
+
+    // the result of converting one record
+    struct Conversion {
+        char txref[txref::limits::TXREF_MAX_LENGTH];
+        std::size_t txrefLength = 0;
+        int blockHeight = 0;
+        int transactionIndex = 0;
+        int txoIndex = 0;
+        std::string error;
+    };
+
+    void convertValues(const Options & options, const std::vector<Field> & values, Conversion & conversion) {
+        conversion.error.clear();
+        // the txo column is optional when encoding
+        std::size_t required = options.mode == Mode::encode ? 2 : 1;
+        for(std::size_t i = 0; i < required; ++i) {
+            if(values[i].begin == nullptr) {
+                conversion.error = "missing column";
+                return;
+            }
+        }
+        try {
+            if(options.mode == Mode::encode) {
+                txref::Coordinates coordinates;
+                if(!parseInt(values[0], coordinates.blockHeight) ||
+                   !parseInt(values[1], coordinates.transactionIndex) ||
+                   (values.size() > 2 && values[2].begin != nullptr && !values[2].empty() && !parseInt(values[2], coordinates.txoIndex))) {
+                    conversion.error = "not a number";
+                    return;
+                }
+                coordinates.magicCode = coordinates.txoIndex > 0 ? options.magicCodeExtended : options.magicCode;
+                conversion.txrefLength = txref::encodeTo(
+                        conversion.txref, sizeof(conversion.txref), coordinates);
+            }
+            else {
+                txref::Coordinates coordinates;
+                if(!txref::decodeTo(values[0].begin, static_cast<std::size_t>(values[0].end - values[0].begin), coordinates)) {
+                    conversion.error = "not a valid txref";
+                    return;
+                }
+                conversion.blockHeight = coordinates.blockHeight;
+                conversion.transactionIndex = coordinates.transactionIndex;
+                conversion.txoIndex = coordinates.txoIndex;
+            }
+        }
+        catch(const std::exception & e) {
+            conversion.error = e.what();
+        }
+    }
+
+    void appendDelimitedResult(std::string & out, const Options & options, const Conversion & conversion) {
+        char delimiter = options.format == Format::tsv ? '\t' : ',';
+        out += delimiter;
+        if(conversion.error.empty()) {
+            if(options.mode == Mode::encode) {
+                out.append(conversion.txref, conversion.txrefLength);
+            }
+            else {
+                out += std::to_string(conversion.blockHeight);
+                out += delimiter;
+                out += std::to_string(conversion.transactionIndex);
+                out += delimiter;
+                out += std::to_string(conversion.txoIndex);
+            }
+            out += delimiter;
+        }
+        else {
+            if(options.mode == Mode::decode) {
+                out += delimiter;
+                out += delimiter;
+            }
+            out += delimiter;
+            appendEscaped(out, conversion.error, options.format);
+        }
+    }
+
+    // appends the converted record with new fields added before the closing brace
+    void appendJsonResult(std::string & out, const char * begin, const char * end, const Conversion & conversion, const Options & options) {
+        const char * close = end;
+        while(close > begin && close[-1] != '}')
+            --close;
+        if(close == begin) { // not an object, pass through
+            out.append(begin, end);
+            return;
+        }
+        --close;
+        const char * last = close;
+        while(last > begin && (last[-1] == ' ' || last[-1] == '\t'))
+            --last;
+        bool emptyObject = last > begin && last[-1] == '{';
+
+        out.append(begin, close);
+        if(!emptyObject)
+            out += ',';
+        if(!conversion.error.empty()) {
+            out += "\"error\":\"";
+            appendEscaped(out, conversion.error, options.format);
+            out += '"';
+        }
+        else if(options.mode == Mode::encode) {
+            out += "\"txref\":\"";
+            out.append(conversion.txref, conversion.txrefLength);
+            out += '"';
+        }
+        else {
+            out += "\"blockHeight\":" + std::to_string(conversion.blockHeight);
+            out += ",\"transactionIndex\":" + std::to_string(conversion.transactionIndex);
+            out += ",\"txoIndex\":" + std::to_string(conversion.txoIndex);
+        }
+        out.append(close, end);
+    }
+
+    // converts all records in [begin, end) and returns the output text for them
+    std::string convertChunk(const Options & options, const ColumnRefs & refs, const char * begin, const char * end) {
+        std::string out;
+        out.reserve(static_cast<std::size_t>(end - begin) + static_cast<std::size_t>(end - begin) / 2);
+
+        char delimiter = options.format == Format::tsv ? '\t' : ',';
+        std::vector<Field> fields;
+        std::vector<Field> values(options.columns.size());
+        Conversion conversion;
+
+        const char * pos = begin;
+        while(pos < end) {
+            const char * next;
+            const char * recEnd = recordEnd(pos, end, &next);
+
+            if(recEnd == pos) { // blank line
+                out += '\n';
+                pos = next;
+                continue;
+            }
+
+            if(options.format == Format::ndjson) {
+                for(std::size_t i = 0; i < refs.keys.size(); ++i)
+                    if(!findJsonValue(pos, recEnd, refs.keys[i], values[i]))
+                        values[i] = Field();
+                convertValues(options, values, conversion);
+                appendJsonResult(out, pos, recEnd, conversion, options);
+            }
+            else {
+                splitRecord(pos, recEnd, delimiter, fields);
+                for(std::size_t i = 0; i < refs.indexes.size(); ++i)
+                    values[i] = refs.indexes[i] < fields.size() ? fields[refs.indexes[i]] : Field();
+                convertValues(options, values, conversion);
+                out.append(pos, recEnd);
+                appendDelimitedResult(out, options, conversion);
+            }
+            out += '\n';
+            pos = next;
+        }
+        return out;
+    }
+
+    // chunk boundaries from start, each chunk ending just after a '\n'
+    std::vector<std::pair<std::size_t, std::size_t>> splitChunks(const MappedFile & file, std::size_t start, std::size_t chunkSize) {
+        std::vector<std::pair<std::size_t, std::size_t>> chunks;
+        while(start < file.size()) {
+            std::size_t target = std::min(file.size(), start + chunkSize);
+            std::size_t stop = file.size();
+            if(target < file.size()) {
+                auto newline = static_cast<const char *>(
+                        std::memchr(file.data() + target, '\n', file.size() - target));
+                if(newline != nullptr)
+                    stop = static_cast<std::size_t>(newline - file.data()) + 1;
+            }
+            chunks.emplace_back(start, stop);
+            start = stop;
+        }
+        return chunks;
+    }
+
+    struct Checkpoint {
+        std::size_t inputSize = 0;
+        std::size_t inputOffset = 0;
+        std::size_t outputOffset = 0;
+    };
+
+    bool readCheckpoint(const std::string & path, Checkpoint & checkpoint) {
+        std::ifstream in(path);
+        if(!in)
+            return false;
+        std::string magic;
+        in >> magic >> checkpoint.inputSize >> checkpoint.inputOffset >> checkpoint.outputOffset;
+        if(!in || magic != "txrefConvert-checkpoint-v1")
+            throw std::runtime_error("can't read checkpoint file " + path);
+        return true;
+    }
+
+    // writes the checkpoint to a temporary file and renames it into place, so a crash
+    // never leaves a partial checkpoint behind
+    void writeCheckpoint(const std::string & path, const Checkpoint & checkpoint) {
+        std::string tmp = path + ".tmp";
+        {
+            std::ofstream out(tmp, std::ios::trunc);
+            out << "txrefConvert-checkpoint-v1 " << checkpoint.inputSize << ' '
+                << checkpoint.inputOffset << ' ' << checkpoint.outputOffset << '\n';
+            if(!out)
+                throw std::runtime_error("can't write checkpoint file " + tmp);
+        }
+        if(std::rename(tmp.c_str(), path.c_str()) != 0)
+            throw std::runtime_error("can't rename checkpoint file " + tmp);
+    }
+
+    // resolves the named columns against the CSV/TSV header row or NDJSON keys
+    ColumnRefs resolveColumns(const Options & options, const Field & header) {
+        ColumnRefs refs;
+        if(options.format == Format::ndjson) {
+            refs.keys = options.columns;
+            return refs;
+        }
+        std::vector<Field> names;
+        splitRecord(header.begin, header.end, options.format == Format::tsv ? '\t' : ',', names);
+        for(const auto & column : options.columns) {
+            auto it = std::find_if(names.begin(), names.end(), [&column](const Field & name) {
+                return static_cast<std::size_t>(name.end - name.begin) == column.length() &&
+                       std::equal(name.begin, name.end, column.begin());
+            });
+            if(it == names.end())
+                throw std::runtime_error("column not found in header: " + column);
+            refs.indexes.push_back(static_cast<std::size_t>(it - names.begin()));
+        }
+        return refs;
+    }
+
+    std::string headerLine(const Options & options, const Field & header) {
+        char delimiter = options.format == Format::tsv ? '\t' : ',';
+        std::string line(header.begin, header.end);
+        if(options.mode == Mode::encode) {
+            line += delimiter;
+            line += "txref";
+        }
+        else {
+            for(const char * name : {"blockHeight", "transactionIndex", "txoIndex"}) {
+                line += delimiter;
+                line += name;
+            }
+        }
+        line += delimiter;
+        line += "error\n";
+        return line;
+    }
+
+    int run(const Options & options) {
+        MappedFile input(options.input, MADV_SEQUENTIAL);
+
+        // header row for CSV/TSV
+        Field header;
+        std::size_t dataStart = 0;
+        if(options.format != Format::ndjson) {
+            const char * next;
+            header.begin = input.data();
+            header.end = input.size() == 0 ? input.data() : recordEnd(input.data(), input.data() + input.size(), &next);
+            if(header.begin == header.end)
+                throw std::runtime_error("input has no header row");
+            dataStart = static_cast<std::size_t>(next - input.data());
+        }
+        ColumnRefs refs = resolveColumns(options, header);
+
+        Checkpoint checkpoint;
+        checkpoint.inputSize = input.size();
+        checkpoint.inputOffset = dataStart;
+        bool resuming = !options.checkpoint.empty() && readCheckpoint(options.checkpoint, checkpoint);
+        if(resuming && checkpoint.inputSize != input.size())
+            throw std::runtime_error("input file has changed since the checkpoint was written");
+
+        int out = STDOUT_FILENO;
+        if(options.output != "-") {
+            out = ::open(options.output.c_str(), O_WRONLY | O_CREAT | (resuming ? 0 : O_TRUNC), 0644);
+            if(out < 0)
+                throw std::runtime_error("can't open " + options.output + ": " + std::strerror(errno));
+        }
+        if(resuming) {
+            // drop anything written after the last checkpoint
+            if(::ftruncate(out, static_cast<off_t>(checkpoint.outputOffset)) != 0 ||
+               ::lseek(out, 0, SEEK_END) < 0) {
+                ::close(out);
+                throw std::runtime_error("can't truncate " + options.output + ": " + std::strerror(errno));
+            }
+            std::cerr << "resuming at input offset " << checkpoint.inputOffset << "\n";
+        }
+        else if(options.format != Format::ndjson) {
+            std::string line = headerLine(options, header);
+            writeAll(out, line);
+            checkpoint.outputOffset = line.size();
+        }
+
+        auto chunks = splitChunks(input, checkpoint.inputOffset, options.chunkSize);
+
+        // workers convert chunks in any order, but the chunks are written in order
+        int status = 0;
+        try {
+            tools::runOrdered<std::string>(chunks.size(), options.threads, [&](std::size_t i) {
+                return convertChunk(options, refs, input.data() + chunks[i].first, input.data() + chunks[i].second);
+            }, [&](std::size_t i, const std::string & result) {
+                writeAll(out, result);
+                checkpoint.inputOffset = chunks[i].second;
+                checkpoint.outputOffset += result.size();
+                if(!options.checkpoint.empty()) {
+                    if(::fdatasync(out) != 0)
+                        throw std::runtime_error(std::string("sync failed: ") + std::strerror(errno));
+                    writeCheckpoint(options.checkpoint, checkpoint);
+                }
+            });
+        }
+        catch(const std::exception & e) {
+            std::cerr << e.what() << "\n";
+            status = 1;
+        }
+        if(out != STDOUT_FILENO)
+            ::close(out);
+
+        if(status == 0 && !options.checkpoint.empty())
+            std::remove(options.checkpoint.c_str());
+        return status;
+    }
+
+}
+
+int main(int argc, char* argv[])
+{
+    Options options;
+    try {
+        options = parseOptions(argc, argv);
+    }
+    catch(const std::exception & e) {
+        std::cerr << e.what() << "\n\n";
+        usage(argv[0]);
+        return 1;
+    }
+
+    try {
+        return run(options);
+    }
+    catch(const std::exception & e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,488 @@
+#include "libtxref.h"
+#include <cerrno>
+#include <climits>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Finds txrefs in text files (typically logs) and prints each one, decoded, as a line of
+// NDJSON. With --follow, the files are watched with inotify and only newly appended
+// bytes are scanned. Rotation (by rename or by truncation) is detected and the new
+// file is read from the start, after draining whatever was left in the old one.
+
+namespace {
+
+    const std::size_t READ_SIZE = 1024 * 1024;
+
+    // longest token that is checked for txrefs. Leaves room for a prefix before the HRP,
+    // ex: "txref:tx1:rjk0-uqay-z9l7-m9m"
+    const std::size_t MAX_TOKEN_LENGTH = 4 * static_cast<std::size_t>(txref::limits::TXREF_MAX_LENGTH);
+
+    // how often files are checked even without inotify events, in milliseconds. This
+    // catches events inotify can't report, such as files on some network filesystems
+    const int POLL_INTERVAL = 1000;
+
+    volatile std::sig_atomic_t stopRequested = 0;
+
+    void handleSignal(int) {
+        stopRequested = 1;
+    }
+
+    void usage(const char * name) {
+        std::cerr << "Usage:\n";
+        std::cerr << name << " [options] <file>...\n\n";
+        std::cerr << "Prints every txref found in the files as NDJSON. Reads stdin if no file is given.\n";
+        std::cerr << "Each line has the file name and inode, and the byte offset of the txref in it.\n\n";
+        std::cerr << "Options:\n";
+        std::cerr << "  --follow, -f        keep watching the files for appended data and rotation\n";
+        std::cerr << "  --from-start        with --follow, scan existing contents first (default: only new data)\n";
+        std::cerr << "  --state <file>      with --follow, save read offsets in <file> and resume from them\n";
+    }
+
+    bool isTokenChar(char c) {
+        return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+               c == txref::colon || c == txref::hyphen;
+    }
+
+    void appendJsonString(std::string & out, const std::string & text) {
+        out += '"';
+        for(char c : text) {
+            if(c == '"' || c == '\\')
+                out += '\\';
+            if(static_cast<unsigned char>(c) < 0x20)
+                continue;
+            out += c;
+        }
+        out += '"';
+    }
+
+    bool isHrpStart(const std::string & token, std::size_t pos) {
+        return pos + 1 < token.size() && (token[pos] == 't' || token[pos] == 'T') &&
+               (token[pos + 1] == 'x' || token[pos + 1] == 'X');
+    }
+
+    // splits a byte stream into candidate tokens (runs of alphanumerics, colons and
+    // hyphens) and reports the txrefs in them. A txref may follow a prefix and a separator
+    // in the same token, ex: "ref:tx1:rjk0-uqay-z9l7-m9m". Tokens may span calls to
+    // feed(), so data can be passed in as it arrives.
+    class Scanner {
+    public:
+        Scanner(const std::string & file, std::string & out) : file_(file), out_(out) {}
+
+        // the inode of the file being read, which tells apart the files a path named
+        // before and after a rotation, since offsets start over from 0
+        void setInode(unsigned long long inode) {
+            inode_ = inode;
+        }
+
+        void feed(const char * data, std::size_t len, unsigned long long offset) {
+            for(std::size_t i = 0; i < len; ++i) {
+                char c = data[i];
+                if(isTokenChar(c)) {
+                    if(token_.empty())
+                        tokenOffset_ = offset + i;
+                    // overly long tokens are never decoded, so stop copying them
+                    if(token_.size() <= MAX_TOKEN_LENGTH)
+                        token_ += c;
+                }
+                else if(!token_.empty()) {
+                    check();
+                }
+            }
+        }
+
+        // end of input: check a token that ran up to the end
+        void finish() {
+            if(!token_.empty())
+                check();
+        }
+
+        // discard a partial token, ex: when the file was truncated
+        void reset() {
+            token_.clear();
+        }
+
+        // where scanning must restart to see everything after the last reported txref: the
+        // start of a token that may still become one, or else 'end', the end of the input fed
+        // so far
+        unsigned long long pendingOffset(unsigned long long end) const {
+            return token_.empty() || token_.size() > MAX_TOKEN_LENGTH ? end : tokenOffset_;
+        }
+
+    private:
+        void check() {
+            std::string token;
+            token.swap(token_);
+            if(token.size() > MAX_TOKEN_LENGTH)
+                return;
+
+            // ignore trailing separators, ex: "(tx1:rjk0-uqay-z9l7-m9m)."
+            auto last = token.find_last_not_of(":-");
+            if(last == std::string::npos)
+                return;
+            token.resize(last + 1);
+
+            // only consider candidates starting with an HRP, at the start of the token or
+            // after a separator; anything else is far too ambiguous in free text
+            for(std::size_t start = 0; start < token.size(); ++start) {
+                bool afterSeparator = start == 0 || token[start - 1] == txref::colon || token[start - 1] == txref::hyphen;
+                if(afterSeparator && isHrpStart(token, start) && report(token.substr(start), tokenOffset_ + start))
+                    return;
+            }
+        }
+
+        // reports the candidate if it is a txref
+        bool report(const std::string & candidate, unsigned long long offset) {
+            if(candidate.size() < static_cast<std::size_t>(txref::limits::TXREF_STRING_MIN_LENGTH) ||
+               candidate.size() > static_cast<std::size_t>(txref::limits::TXREF_MAX_LENGTH))
+                return false;
+
+            txref::InputParam param = txref::classifyInputString(candidate);
+            if(param != txref::InputParam::txref && param != txref::InputParam::txrefext)
+                return false;
+
+            txref::DecodedResult decoded;
+            try {
+                decoded = txref::decode(candidate);
+            }
+            catch(const std::exception &) {
+                return false;
+            }
+
+            out_ += "{\"file\":";
+            appendJsonString(out_, file_);
+            out_ += ",\"inode\":" + std::to_string(inode_);
+            out_ += ",\"offset\":" + std::to_string(offset);
+            out_ += ",\"txref\":";
+            appendJsonString(out_, decoded.txref);
+            out_ += ",\"hrp\":";
+            appendJsonString(out_, decoded.hrp);
+            out_ += ",\"blockHeight\":" + std::to_string(decoded.blockHeight);
+            out_ += ",\"transactionIndex\":" + std::to_string(decoded.transactionIndex);
+            out_ += ",\"txoIndex\":" + std::to_string(decoded.txoIndex);
+            out_ += "}\n";
+            return true;
+        }
+
+        std::string file_;
+        std::string & out_;
+        std::string token_;
+        unsigned long long tokenOffset_ = 0;
+        unsigned long long inode_ = 0;
+    };
+
+    void flush(std::string & out) {
+        if(out.empty())
+            return;
+        std::fwrite(out.data(), 1, out.size(), stdout);
+        std::fflush(stdout);
+        out.clear();
+    }
+
+    // a followed file. 'fd' stays open on the file that was read last, so that data
+    // written to it after a rename-style rotation is still picked up
+    struct Followed {
+        std::string path;
+        std::string directory;
+        std::string name;
+        int fd = -1;
+        dev_t device = 0;
+        ino_t inode = 0;
+        unsigned long long offset = 0;
+        bool dirty = true;
+    };
+
+    void splitPath(const std::string & path, std::string & directory, std::string & name) {
+        auto slash = path.rfind('/');
+        if(slash == std::string::npos) {
+            directory = ".";
+            name = path;
+        }
+        else {
+            directory = slash == 0 ? "/" : path.substr(0, slash);
+            name = path.substr(slash + 1);
+        }
+    }
+
+    // reads everything from the current offset to the end of the file
+    void readNew(Followed & file, Scanner & scanner, std::vector<char> & buffer) {
+        while(true) {
+            ssize_t n = ::pread(file.fd, buffer.data(), buffer.size(), static_cast<off_t>(file.offset));
+            if(n < 0) {
+                if(errno == EINTR)
+                    continue;
+                throw std::runtime_error("can't read " + file.path + ": " + std::strerror(errno));
+            }
+            if(n == 0)
+                return;
+            scanner.feed(buffer.data(), static_cast<std::size_t>(n), file.offset);
+            file.offset += static_cast<unsigned long long>(n);
+        }
+    }
+
+    bool openFollowed(Followed & file) {
+        int fd = ::open(file.path.c_str(), O_RDONLY);
+        if(fd < 0)
+            return false;
+        struct stat st {};
+        if(::fstat(fd, &st) != 0) {
+            ::close(fd);
+            return false;
+        }
+        file.fd = fd;
+        file.device = st.st_dev;
+        file.inode = st.st_ino;
+        return true;
+    }
+
+    // brings a followed file up to date: scans new bytes and handles rotation
+    void checkFollowed(Followed & file, Scanner & scanner, std::vector<char> & buffer) {
+        if(file.fd < 0) {
+            if(!openFollowed(file))
+                return; // not created yet
+            file.offset = 0;
+        }
+        scanner.setInode(static_cast<unsigned long long>(file.inode));
+
+        readNew(file, scanner, buffer);
+
+        struct stat st {};
+        if(::stat(file.path.c_str(), &st) != 0)
+            return; // moved away, new file not created yet. Keep reading the old one
+
+        if(st.st_dev != file.device || st.st_ino != file.inode) {
+            // rotated: the old file was drained above, switch to the new one
+            scanner.finish();
+            ::close(file.fd);
+            file.fd = -1;
+            if(openFollowed(file)) {
+                file.offset = 0;
+                scanner.setInode(static_cast<unsigned long long>(file.inode));
+                readNew(file, scanner, buffer);
+            }
+            return;
+        }
+
+        struct stat current {};
+        if(::fstat(file.fd, &current) == 0 && static_cast<unsigned long long>(current.st_size) < file.offset) {
+            // truncated in place (copytruncate)
+            scanner.reset();
+            file.offset = 0;
+            readNew(file, scanner, buffer);
+        }
+    }
+
+    // state file lines: "<device> <inode> <offset> <path>"
+    void loadState(const std::string & path, std::vector<Followed> & files) {
+        std::ifstream in(path);
+        unsigned long long device, inode, offset;
+        std::string filePath;
+        while(in >> device >> inode >> offset && std::getline(in >> std::ws, filePath)) {
+            for(auto & file : files) {
+                if(file.path == filePath && file.fd >= 0 &&
+                   static_cast<unsigned long long>(file.device) == device &&
+                   static_cast<unsigned long long>(file.inode) == inode)
+                    file.offset = offset;
+            }
+        }
+    }
+
+    // saves, for each file, the offset to resume from. That is before any token the scanner
+    // is still holding, so a txref written in several parts isn't lost by a restart.
+    void saveState(const std::string & path, const std::vector<Followed> & files,
+                   const std::vector<Scanner> & scanners) {
+        std::string tmp = path + ".tmp";
+        {
+            std::ofstream out(tmp, std::ios::trunc);
+            for(std::size_t i = 0; i < files.size(); ++i)
+                if(files[i].fd >= 0)
+                    out << static_cast<unsigned long long>(files[i].device) << ' '
+                        << static_cast<unsigned long long>(files[i].inode) << ' '
+                        << scanners[i].pendingOffset(files[i].offset) << ' ' << files[i].path << '\n';
+            if(!out)
+                throw std::runtime_error("can't write state file " + tmp);
+        }
+        if(std::rename(tmp.c_str(), path.c_str()) != 0)
+            throw std::runtime_error("can't rename state file " + tmp);
+    }
+
+    int follow(const std::vector<std::string> & paths, bool fromStart, const std::string & statePath) {
+        struct sigaction action {};
+        action.sa_handler = handleSignal;
+        sigemptyset(&action.sa_mask);
+        ::sigaction(SIGINT, &action, nullptr);
+        ::sigaction(SIGTERM, &action, nullptr);
+
+        int inotify = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if(inotify < 0)
+            throw std::runtime_error(std::string("inotify_init1 failed: ") + std::strerror(errno));
+
+        std::vector<Followed> files(paths.size());
+        std::vector<int> watches(paths.size());
+        for(std::size_t i = 0; i < paths.size(); ++i) {
+            Followed & file = files[i];
+            file.path = paths[i];
+            splitPath(file.path, file.directory, file.name);
+            // watch the directory rather than the file, so rotation is seen too
+            watches[i] = ::inotify_add_watch(inotify, file.directory.c_str(),
+                                             IN_MODIFY | IN_CREATE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE);
+            if(watches[i] < 0)
+                throw std::runtime_error("can't watch " + file.directory + ": " + std::strerror(errno));
+            if(openFollowed(file) && !fromStart) {
+                struct stat st {};
+                if(::fstat(file.fd, &st) == 0)
+                    file.offset = static_cast<unsigned long long>(st.st_size);
+            }
+        }
+        if(!statePath.empty())
+            loadState(statePath, files);
+
+        std::string out;
+        std::vector<Scanner> scanners;
+        scanners.reserve(files.size());
+        for(const auto & file : files)
+            scanners.emplace_back(file.path, out);
+
+        std::vector<char> buffer(READ_SIZE);
+        alignas(struct inotify_event) char events[64 * (sizeof(struct inotify_event) + NAME_MAX + 1)];
+
+        while(!stopRequested) {
+            for(std::size_t i = 0; i < files.size(); ++i) {
+                if(files[i].dirty) {
+                    checkFollowed(files[i], scanners[i], buffer);
+                    files[i].dirty = false;
+                }
+            }
+            flush(out);
+            if(!statePath.empty())
+                saveState(statePath, files, scanners);
+
+            struct pollfd pfd {};
+            pfd.fd = inotify;
+            pfd.events = POLLIN;
+            int ready = ::poll(&pfd, 1, POLL_INTERVAL);
+            if(ready < 0) {
+                if(errno == EINTR)
+                    continue;
+                throw std::runtime_error(std::string("poll failed: ") + std::strerror(errno));
+            }
+            if(ready == 0) {
+                // periodic check
+                for(auto & file : files)
+                    file.dirty = true;
+                continue;
+            }
+
+            ssize_t len;
+            while((len = ::read(inotify, events, sizeof(events))) > 0) {
+                for(char * pos = events; pos < events + len; ) {
+                    auto event = reinterpret_cast<struct inotify_event *>(pos);
+                    for(std::size_t i = 0; i < files.size(); ++i)
+                        if(event->wd == watches[i] && event->len > 0 && files[i].name == event->name)
+                            files[i].dirty = true;
+                    if(event->mask & IN_Q_OVERFLOW)
+                        for(auto & file : files)
+                            file.dirty = true;
+                    pos += sizeof(struct inotify_event) + event->len;
+                }
+            }
+        }
+
+        for(auto & file : files)
+            if(file.fd >= 0)
+                ::close(file.fd);
+        ::close(inotify);
+        return 0;
+    }
+
+    int scanOnce(const std::vector<std::string> & paths) {
+        std::string out;
+        std::vector<char> buffer(READ_SIZE);
+
+        if(paths.empty()) {
+            Scanner scanner("-", out);
+            struct stat st {};
+            if(::fstat(STDIN_FILENO, &st) == 0)
+                scanner.setInode(static_cast<unsigned long long>(st.st_ino));
+            unsigned long long offset = 0;
+            std::size_t n;
+            while((n = std::fread(buffer.data(), 1, buffer.size(), stdin)) > 0) {
+                scanner.feed(buffer.data(), n, offset);
+                offset += n;
+                flush(out);
+            }
+            scanner.finish();
+            flush(out);
+            return 0;
+        }
+
+        int status = 0;
+        for(const auto & path : paths) {
+            Followed file;
+            file.path = path;
+            if(!openFollowed(file)) {
+                std::cerr << "can't open " << path << ": " << std::strerror(errno) << "\n";
+                status = 1;
+                continue;
+            }
+            Scanner scanner(path, out);
+            scanner.setInode(static_cast<unsigned long long>(file.inode));
+            readNew(file, scanner, buffer);
+            scanner.finish();
+            flush(out);
+            ::close(file.fd);
+        }
+        return status;
+    }
+
+}
+
+int main(int argc, char* argv[])
+{
+    bool followFiles = false;
+    bool fromStart = false;
+    std::string statePath;
+    std::vector<std::string> paths;
+
+    for(int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if(arg == "--follow" || arg == "-f")
+            followFiles = true;
+        else if(arg == "--from-start")
+            fromStart = true;
+        else if(arg == "--state" && i + 1 < argc)
+            statePath = argv[++i];
+        else if(arg == "--help" || (arg.size() > 1 && arg[0] == '-')) {
+            usage(argv[0]);
+            return 1;
+        }
+        else
+            paths.push_back(arg);
+    }
+
+    if(followFiles && paths.empty()) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    try {
+        if(followFiles)
+            return follow(paths, fromStart, statePath);
+        return scanOnce(paths);
+    }
+    catch(const std::exception & e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+}
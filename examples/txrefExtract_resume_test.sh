@@ -0,0 +1,22 @@
+#!/bin/sh
+# Checks that txrefExtract --follow --state finds a txref written in two parts with a
+# restart in between. Usage: txrefExtract_resume_test.sh <txrefExtract>
+set -e
+extract="$1"
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+follow() {
+    "$extract" --follow --from-start --state "$dir/state" "$dir/log" >> "$dir/out" &
+    pid=$!
+    sleep 1
+    kill -TERM "$pid"
+    wait "$pid"
+}
+
+printf 'see tx1:rjk0-uq' > "$dir/log"
+follow
+printf 'ay-z9l7-m9m for details\n' >> "$dir/log"
+follow
+
+cat "$dir/out"
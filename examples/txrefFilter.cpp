@@ -0,0 +1,170 @@
+#include "libtxref.h"
+#include "toolSupport.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// Builds a txref::TxFilter from a file with one txid, txref or txref-ext per line, and
+// queries saved filters. A saved filter is memory-mapped and queried in place, so even
+// very large filters are ready immediately.
+
+namespace {
+
+    using tools::MappedFile;
+    using tools::writeAll;
+
+    void usage(const char * name) {
+        std::cerr << "Usage:\n";
+        std::cerr << name << " build [--threads <n>] <keys> <filter>\n";
+        std::cerr << "or\n";
+        std::cerr << name << " query <filter> [<txid or txref>...]\n\n";
+        std::cerr << "build reads one txid, txref or txref-ext per line; blank lines are skipped.\n";
+        std::cerr << "query prints \"maybe\" or \"no\" for each argument, or for each line of stdin.\n";
+    }
+
+    // the keys for the lines in [begin, end). Lines that are neither a txid nor a txref
+    // are counted in 'invalid' and the first one is kept in 'example'.
+    void readKeys(const char * begin, const char * end, std::vector<std::uint64_t> & keys,
+                  std::size_t & invalid, std::string & example) {
+        std::string line;
+        while(begin < end) {
+            auto newline = static_cast<const char *>(std::memchr(begin, '\n', static_cast<std::size_t>(end - begin)));
+            const char * lineEnd = newline == nullptr ? end : newline;
+            line.assign(begin, lineEnd);
+            begin = newline == nullptr ? end : newline + 1;
+
+            while(!line.empty() && (line.back() == '\r' || line.back() == ' ' || line.back() == '\t'))
+                line.pop_back();
+            if(line.empty())
+                continue;
+
+            std::uint64_t key;
+            if(txref::TxFilter::inputKey(line, key))
+                keys.push_back(key);
+            else if(invalid++ == 0)
+                example = line;
+        }
+    }
+
+    int build(const std::string & keysPath, const std::string & filterPath, unsigned int threads) {
+        if(threads == 0)
+            threads = std::max(1u, std::thread::hardware_concurrency());
+
+        MappedFile input(keysPath, MADV_SEQUENTIAL);
+        const char * data = input.data();
+        std::size_t size = input.size();
+
+        // split the file at line boundaries and parse the parts in parallel. An empty file
+        // isn't mapped and data is null, so it is left as one empty part
+        std::vector<const char *> bounds(1, data);
+        for(unsigned int t = 1; t < threads && size > 0; ++t) {
+            const char * pos = std::max(bounds.back(), data + size / threads * t);
+            auto newline = static_cast<const char *>(std::memchr(pos, '\n', static_cast<std::size_t>(data + size - pos)));
+            bounds.push_back(newline == nullptr ? data + size : newline + 1);
+        }
+        bounds.push_back(data + size);
+
+        std::size_t parts = bounds.size() - 1;
+        std::vector<std::vector<std::uint64_t>> keys(parts);
+        std::vector<std::size_t> invalid(parts, 0);
+        std::vector<std::string> examples(parts);
+        std::vector<std::thread> workers;
+        for(std::size_t i = 0; i < parts; ++i)
+            workers.emplace_back(readKeys, bounds[i], bounds[i + 1], std::ref(keys[i]),
+                                 std::ref(invalid[i]), std::ref(examples[i]));
+        for(auto & worker : workers)
+            worker.join();
+
+        std::vector<std::uint64_t> all;
+        for(std::size_t i = 0; i < parts; ++i) {
+            if(invalid[i] > 0) {
+                std::size_t total = 0;
+                for(std::size_t count : invalid)
+                    total += count;
+                std::cerr << total << " line(s) are neither a txid nor a txref, ex: " << examples[i] << "\n";
+                return 1;
+            }
+            all.insert(all.end(), keys[i].begin(), keys[i].end());
+            std::vector<std::uint64_t>().swap(keys[i]);
+        }
+
+        txref::TxFilter filter = txref::TxFilter::build(std::move(all), threads);
+        std::vector<unsigned char> bytes = filter.serialize();
+
+        int out = ::open(filterPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if(out < 0)
+            throw std::runtime_error("can't open " + filterPath + ": " + std::strerror(errno));
+        try {
+            writeAll(out, bytes.data(), bytes.size());
+        }
+        catch(const std::exception &) {
+            ::close(out);
+            throw;
+        }
+        ::close(out);
+
+        std::cerr << filter.size() << " distinct keys, " << bytes.size() << " bytes\n";
+        return 0;
+    }
+
+    int query(const std::string & filterPath, const std::vector<std::string> & inputs) {
+        MappedFile file(filterPath);
+        txref::TxFilter filter = txref::TxFilter::view(file.bytes(), file.size());
+
+        auto answer = [&](const std::string & input) {
+            std::cout << (filter.mayContain(input) ? "maybe" : "no") << '\t' << input << '\n';
+        };
+
+        if(!inputs.empty()) {
+            for(const auto & input : inputs)
+                answer(input);
+            return 0;
+        }
+        std::string line;
+        while(std::getline(std::cin, line)) {
+            if(!line.empty() && line.back() == '\r')
+                line.pop_back();
+            answer(line);
+        }
+        return 0;
+    }
+
+}
+
+int main(int argc, char* argv[])
+{
+    std::vector<std::string> args(argv + 1, argv + argc);
+    try {
+        unsigned int threads = 0;
+        for(std::size_t i = 0; i + 1 < args.size(); ++i) {
+            if(args[i] == "--threads") {
+                threads = static_cast<unsigned int>(std::stoul(args[i + 1]));
+                args.erase(args.begin() + static_cast<std::ptrdiff_t>(i), args.begin() + static_cast<std::ptrdiff_t>(i) + 2);
+                break;
+            }
+        }
+
+        if(args.size() == 3 && args[0] == "build")
+            return build(args[1], args[2], threads);
+        if(args.size() >= 2 && args[0] == "query")
+            return query(args[1], std::vector<std::string>(args.begin() + 2, args.end()));
+    }
+    catch(const std::exception & e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    usage(argv[0]);
+    return 1;
+}
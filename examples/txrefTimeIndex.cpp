@@ -0,0 +1,286 @@
+#include "libtxref.h"
+#include "toolSupport.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Builds a txref::BlockTimeIndex from a file of consecutive 80-byte block headers, or
+// from a node's blk*.dat files, and uses a saved index to turn a time range into a
+// block height range, or to add block times to decoded txrefs. A saved index is
+// memory-mapped and queried in place.
+
+namespace {
+
+    using tools::MappedFile;
+
+    void usage(const char * name) {
+        std::cerr << "Usage:\n";
+        std::cerr << name << " build [--network main|test|regtest] --headers <file> <index>\n";
+        std::cerr << name << " build [--network main|test|regtest] --blocks <blocks dir or blk file>... <index>\n";
+        std::cerr << name << " range [--median] <index> <from> <to>\n";
+        std::cerr << name << " decode <index> <txref>...\n\n";
+        std::cerr << "Times are UTC, as YYYY-MM-DD, YYYY-MM-DDThh:mm:ss or seconds since 1970. 'range'\n";
+        std::cerr << "prints the heights [first, end) of the blocks with a timestamp (or, with --median,\n";
+        std::cerr << "a median-time-past) in [from, to).\n";
+    }
+
+    bool isDirectory(const std::string & path) {
+        struct stat st {};
+        return ::stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+    }
+
+    std::string directoryOf(const std::string & path) {
+        auto slash = path.rfind('/');
+        return slash == std::string::npos ? "." : path.substr(0, slash);
+    }
+
+    // the blk*.dat files in a directory, in order
+    std::vector<std::string> blockFiles(const std::string & dir) {
+        std::vector<std::string> files;
+        DIR * d = ::opendir(dir.c_str());
+        if(d == nullptr)
+            throw std::runtime_error("can't open " + dir + ": " + std::strerror(errno));
+        while(dirent * entry = ::readdir(d)) {
+            std::string name = entry->d_name;
+            if(name.size() > 7 && name.compare(0, 3, "blk") == 0 && name.compare(name.size() - 4, 4, ".dat") == 0)
+                files.push_back(dir + "/" + name);
+        }
+        ::closedir(d);
+        std::sort(files.begin(), files.end());
+        return files;
+    }
+
+    // newer nodes obfuscate their block files with the 8-byte key in xor.dat. No key means
+    // the files are stored as they are.
+    std::vector<unsigned char> xorKey(const std::string & dir) {
+        std::vector<unsigned char> key(8, 0);
+        FILE * f = std::fopen((dir + "/xor.dat").c_str(), "rb");
+        if(f != nullptr) {
+            if(std::fread(key.data(), 1, key.size(), f) != key.size())
+                std::fill(key.begin(), key.end(), 0);
+            std::fclose(f);
+        }
+        return key;
+    }
+
+    // copies 'size' bytes at 'offset' of a block file into out, undoing the obfuscation
+    void readAt(const MappedFile & file, std::size_t offset, std::size_t size,
+                const std::vector<unsigned char> & key, unsigned char * out) {
+        for(std::size_t i = 0; i < size; ++i)
+            out[i] = file.bytes()[offset + i] ^ key[(offset + i) % key.size()];
+    }
+
+    // appends the header of every block in a blk*.dat file. Each block is stored as a
+    // 4-byte network magic, a 4-byte little-endian size, and the serialized block.
+    // Files are preallocated, so a zero magic marks the end of the used part.
+    void appendHeaders(const std::string & path, const std::vector<unsigned char> & key,
+                       std::vector<unsigned char> & headers) {
+        MappedFile file(path, MADV_SEQUENTIAL);
+        std::size_t offset = 0;
+        unsigned char prefix[8];
+        while(file.size() - offset >= sizeof(prefix)) {
+            readAt(file, offset, sizeof(prefix), key, prefix);
+            if(prefix[0] == 0 && prefix[1] == 0 && prefix[2] == 0 && prefix[3] == 0)
+                break;
+            std::size_t size = static_cast<std::size_t>(prefix[4]) | static_cast<std::size_t>(prefix[5]) << 8u |
+                               static_cast<std::size_t>(prefix[6]) << 16u | static_cast<std::size_t>(prefix[7]) << 24u;
+            offset += sizeof(prefix);
+            if(size < static_cast<std::size_t>(txref::limits::BLOCK_HEADER_SIZE) || size > file.size() - offset) {
+                std::cerr << path << ": ignoring a truncated block at offset " << offset - sizeof(prefix) << "\n";
+                break;
+            }
+            headers.resize(headers.size() + txref::limits::BLOCK_HEADER_SIZE);
+            readAt(file, offset, txref::limits::BLOCK_HEADER_SIZE, key,
+                   &headers[headers.size() - txref::limits::BLOCK_HEADER_SIZE]);
+            offset += size;
+        }
+    }
+
+    void writeFile(const std::string & path, const std::vector<unsigned char> & bytes) {
+        FILE * f = std::fopen(path.c_str(), "wb");
+        if(f == nullptr)
+            throw std::runtime_error("can't open " + path + ": " + std::strerror(errno));
+        bool ok = std::fwrite(bytes.data(), 1, bytes.size(), f) == bytes.size();
+        ok = std::fclose(f) == 0 && ok;
+        if(!ok)
+            throw std::runtime_error("can't write " + path);
+    }
+
+    int build(std::vector<std::string> args) {
+        int magicCode = txref::MAGIC_CODE_MAIN;
+        if(args.size() >= 2 && args[0] == "--network") {
+            if(args[1] == "main")
+                magicCode = txref::MAGIC_CODE_MAIN;
+            else if(args[1] == "test")
+                magicCode = txref::MAGIC_CODE_TEST;
+            else if(args[1] == "regtest")
+                magicCode = txref::MAGIC_CODE_REGTEST;
+            else
+                throw std::runtime_error("unknown network: " + args[1]);
+            args.erase(args.begin(), args.begin() + 2);
+        }
+        if(args.size() < 3)
+            throw std::runtime_error("missing arguments");
+        std::string output = args.back();
+
+        txref::BlockTimeIndex index;
+        if(args[0] == "--headers" && args.size() == 3) {
+            MappedFile file(args[1]);
+            if(file.size() % txref::limits::BLOCK_HEADER_SIZE != 0)
+                throw std::runtime_error(args[1] + " is not a whole number of 80-byte headers");
+            index = txref::BlockTimeIndex::fromHeaders(file.bytes(), file.size() / txref::limits::BLOCK_HEADER_SIZE,
+                                                       magicCode);
+        }
+        else if(args[0] == "--blocks") {
+            std::vector<unsigned char> headers;
+            for(std::size_t i = 1; i + 1 < args.size(); ++i) {
+                bool dir = isDirectory(args[i]);
+                auto key = xorKey(dir ? args[i] : directoryOf(args[i]));
+                for(const auto & path : dir ? blockFiles(args[i]) : std::vector<std::string>(1, args[i]))
+                    appendHeaders(path, key, headers);
+            }
+            index = txref::BlockTimeIndex::fromUnorderedHeaders(
+                    headers.data(), headers.size() / txref::limits::BLOCK_HEADER_SIZE, magicCode);
+        }
+        else {
+            throw std::runtime_error("build needs --headers or --blocks");
+        }
+
+        auto bytes = index.serialize();
+        writeFile(output, bytes);
+        std::cerr << index.size() << " blocks, " << bytes.size() << " bytes\n";
+        return 0;
+    }
+
+    int daysInMonth(int year, int month) {
+        static const int days[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+        bool leapYear = (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+        return month == 2 && leapYear ? 29 : days[month - 1];
+    }
+
+    // seconds since 1970 for a UTC date, ex: "2021-03-01" or "2021-03-01T12:00:00", or a
+    // number of seconds as it is
+    std::uint32_t parseTime(const std::string & str) {
+        int year, month, day, hour = 0, minute = 0, second = 0;
+        char rest;
+        if(std::sscanf(str.c_str(), "%4d-%2d-%2d%c", &year, &month, &day, &rest) == 3 ||
+           std::sscanf(str.c_str(), "%4d-%2d-%2dT%2d:%2d:%2d%c", &year, &month, &day, &hour, &minute, &second, &rest) == 6) {
+            if(month < 1 || month > 12 || day < 1 || day > daysInMonth(year, month) ||
+               hour < 0 || hour > 23 || minute < 0 || minute > 59 || second < 0 || second > 59)
+                throw std::runtime_error("not a valid date and time: " + str);
+            // days since 1970-01-01 in the proleptic Gregorian calendar
+            int y = year - (month <= 2 ? 1 : 0);
+            int era = y / 400;
+            int yearOfEra = y - era * 400;
+            int dayOfYear = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+            int dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+            long long days = static_cast<long long>(era) * 146097 + dayOfEra - 719468;
+            long long seconds = days * 86400 + hour * 3600 + minute * 60 + second;
+            if(seconds < 0 || seconds > 0xFFFFFFFFLL)
+                throw std::runtime_error("time is out of range: " + str);
+            return static_cast<std::uint32_t>(seconds);
+        }
+        std::size_t used = 0;
+        unsigned long seconds = std::stoul(str, &used);
+        if(used != str.size() || seconds > 0xFFFFFFFFUL)
+            throw std::runtime_error("can't read time: " + str);
+        return static_cast<std::uint32_t>(seconds);
+    }
+
+    std::string formatTime(std::uint32_t seconds) {
+        long long days = seconds / 86400;
+        long long secondsOfDay = seconds % 86400;
+        // the inverse of the conversion in parseTime()
+        days += 719468;
+        long long era = days / 146097;
+        long long dayOfEra = days - era * 146097;
+        long long yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+        long long dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+        long long mp = (5 * dayOfYear + 2) / 153;
+        long long day = dayOfYear - (153 * mp + 2) / 5 + 1;
+        long long month = mp < 10 ? mp + 3 : mp - 9;
+        long long year = yearOfEra + era * 400 + (month <= 2 ? 1 : 0);
+
+        char buffer[32];
+        std::snprintf(buffer, sizeof(buffer), "%04lld-%02lld-%02lldT%02lld:%02lld:%02lldZ", year, month, day,
+                      secondsOfDay / 3600, secondsOfDay / 60 % 60, secondsOfDay % 60);
+        return buffer;
+    }
+
+    int range(std::vector<std::string> args) {
+        bool median = !args.empty() && args[0] == "--median";
+        if(median)
+            args.erase(args.begin());
+        if(args.size() != 3)
+            throw std::runtime_error("missing arguments");
+
+        MappedFile file(args[0]);
+        auto index = txref::BlockTimeIndex::view(file.bytes(), file.size());
+        std::uint32_t from = parseTime(args[1]);
+        std::uint32_t to = parseTime(args[2]);
+        auto heights = median ? index.heightRangeByMedianTime(from, to) : index.heightRange(from, to);
+        std::cout << heights.first << '\t' << heights.second << '\n';
+        return 0;
+    }
+
+    int decode(const std::vector<std::string> & args) {
+        if(args.size() < 2)
+            throw std::runtime_error("missing arguments");
+
+        MappedFile file(args[0]);
+        auto index = txref::BlockTimeIndex::view(file.bytes(), file.size());
+        int status = 0;
+        for(std::size_t i = 1; i < args.size(); ++i) {
+            try {
+                auto result = txref::decode(args[i], index);
+                std::cout << result.txref << '\t' << result.blockHeight << '\t' << result.transactionIndex << '\t'
+                          << result.txoIndex << '\t'
+                          << (result.blockTime != 0 ? formatTime(result.blockTime) : "-") << '\t'
+                          << (result.medianTimePast != 0 ? formatTime(result.medianTimePast) : "-") << '\n';
+            }
+            catch(const std::exception & e) {
+                std::cerr << args[i] << ": " << e.what() << "\n";
+                status = 1;
+            }
+        }
+        return status;
+    }
+
+}
+
+int main(int argc, char* argv[])
+{
+    std::vector<std::string> args(argv + 1, argv + argc);
+    try {
+        if(!args.empty()) {
+            std::string command = args[0];
+            args.erase(args.begin());
+            if(command == "build")
+                return build(args);
+            if(command == "range")
+                return range(args);
+            if(command == "decode")
+                return decode(args);
+        }
+    }
+    catch(const std::exception & e) {
+        std::cerr << e.what() << "\n\n";
+        usage(argv[0]);
+        return 1;
+    }
+
+    usage(argv[0]);
+    return 1;
+}
@@ -5,6 +5,13 @@
 #ifdef __cplusplus
 
 #include <string>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iosfwd>
+#include <memory>
+#include <utility>
 
 namespace txref {
 
@@ -43,6 +50,8 @@ namespace txref {
         int magicCode = 0;
         Encoding encoding = Encoding::Invalid;
         std::string commentary;
+        std::uint32_t blockTime = 0;        // block timestamp, only set by decode() with a BlockTimeIndex
+        std::uint32_t medianTimePast = 0;   // median of the last 11 block timestamps, same
     };
 
     // encodes the position of a confirmed bitcoin transaction on the
@@ -92,6 +101,78 @@ namespace txref {
     DecodedResult decode(const std::string & txref);
 
 
+    // the position of a confirmed bitcoin transaction (or one of its outputs) along with
+    // the magic code of the network it belongs to. The magic code also selects between a
+    // standard and an extended txref, and the HRP is the default one for that network.
+    struct Coordinates {
+        int blockHeight = 0;
+        int transactionIndex = 0;
+        int txoIndex = 0;
+        int magicCode = MAGIC_CODE_MAIN;
+
+        Coordinates() = default;
+        Coordinates(int blockHeight, int transactionIndex, int txoIndex = 0, int magicCode = MAGIC_CODE_MAIN)
+                : blockHeight(blockHeight), transactionIndex(transactionIndex),
+                  txoIndex(txoIndex), magicCode(magicCode) {}
+    };
+
+    // how a txref is laid out when written with encodeTo() or operator<<
+    enum class Style {
+        pretty,  // colon after the HRP and a hyphen every 4 chars, ex: "tx1:rqqq-qqqq-qwtv-vjr"
+        compact  // no separators, ex: "tx1rqqqqqqqqwtvvjr"
+    };
+
+    // writes the txref for the given coordinates into a caller-provided buffer without
+    // allocating any memory. The output is not null-terminated. Returns the number of chars
+    // written, which is never more than limits::TXREF_MAX_LENGTH. Throws if the coordinates
+    // are out of range or the buffer is too short.
+    std::size_t encodeTo(
+            char * out,
+            std::size_t outlen,
+            const Coordinates & coordinates,
+            Style style = Style::pretty,
+            bool uppercase = false
+    );
+
+    // decodes the txref in [txref, txref + length) into coordinates without allocating any
+    // memory. Accepts the same txrefs as decode(). Returns false, leaving coordinates
+    // unchanged, if the input is not a valid txref.
+    bool decodeTo(const char * txref, std::size_t length, Coordinates & coordinates);
+
+    // stream manipulators selecting the Style used by operator<< for Coordinates. The
+    // selection is sticky, like std::hex. Pretty is the default.
+    std::ostream & compact(std::ostream & os);
+    std::ostream & pretty(std::ostream & os);
+
+    // writes the txref for the given coordinates directly to the stream. Honors the
+    // compact/pretty manipulators above, std::uppercase, and the field width, fill and
+    // std::left like a string insertion. Sets failbit instead of throwing if the
+    // coordinates are out of range.
+    std::ostream & operator<<(std::ostream & os, const Coordinates & coordinates);
+
+
+    // encodes the position of a confirmed bitcoin transaction on the mainnet
+    // network like encode(), but returns the compact form of the txref, without
+    // the colon and hyphens. ex: "tx1rjk0uqayz9l7m9m"
+    std::string encodeCompact(
+            int blockHeight,
+            int transactionIndex,
+            int txoIndex = 0,
+            bool forceExtended = false,
+            const std::string & hrp = BECH32_HRP_MAIN
+    );
+
+    // converts any txref that decode() accepts (upper/mixed-case, missing HRP, odd
+    // separators, original bech32 checksum) into one canonical compact form: lower-case,
+    // with the full HRP, a bech32m checksum, and no separators. Suitable as a storage or
+    // join key. Throws if the input is not a valid txref.
+    std::string normalize(const std::string & txref);
+
+    // normalizes each txref in the input. Invalid txrefs produce an empty string rather
+    // than throwing, so results line up with the input.
+    std::vector<std::string> normalize(const std::vector<std::string> & txrefs);
+
+
     enum class InputParam { unknown, address, txid, txref, txrefext };
 
     // determine if the input string is a Bitcoin address, txid, txref, or txrefext. This
@@ -99,6 +180,82 @@ namespace txref {
     // what sort of string might be passed in as input.
     InputParam classifyInputString(const std::string & str);
 
+    // same as classifyInputString(str), but if the input is a txid and txid is not null,
+    // also decodes it into the limits::TXID_SIZE bytes at txid, in the reversed byte
+    // order used inside serialized transactions and blocks.
+    InputParam classifyInputString(const std::string & str, unsigned char * txid);
+
+    // classifies each string in the input. If txids is not null, it is resized to hold
+    // limits::TXID_SIZE bytes per input and each txid found is decoded into its slot as
+    // above. Slots for inputs that aren't txids are zeroed.
+    std::vector<InputParam> classifyInputStrings(
+            const std::vector<std::string> & strs,
+            std::vector<unsigned char> * txids = nullptr);
+
+    // returns true if the input is a txid: exactly limits::TXID_LENGTH hex chars. If txid
+    // is not null, also decodes it as classifyInputString(str, txid) does.
+    bool parseTxid(const std::string & str, unsigned char * txid = nullptr);
+
+    // a compact, static set of txids and/or txref coordinates (a binary fuse filter) that
+    // answers "definitely not in the set" or "maybe in the set". Uses about 9 bits per key
+    // and has about 0.4% false positives. Build it once, save it with serialize(), and
+    // later query the saved bytes in place with view(), for example from a mapped file.
+    class TxFilter {
+    public:
+        // an empty filter, which contains nothing
+        TxFilter() = default;
+
+        // the key for a txid, given in the byte order used by parseTxid()
+        static std::uint64_t txidKey(const unsigned char * txid);
+
+        // the key for a set of coordinates. The magic code is part of the key, so a txref and
+        // a txref-ext for the same transaction, or the same position on another network, are
+        // different keys.
+        static std::uint64_t coordinatesKey(const Coordinates & coordinates);
+
+        // builds a filter holding the given keys, made with txidKey() and/or coordinatesKey().
+        // Duplicate keys are allowed. Sorting and hashing the keys are spread over the given
+        // number of threads (0 means one per core).
+        static TxFilter build(std::vector<std::uint64_t> keys, unsigned int threads = 0);
+
+        // checks a filter previously written by serialize() and queries it in place. The data
+        // is not copied, so it must outlive the returned filter and any copies of it. Throws
+        // if the data is not a valid filter.
+        static TxFilter view(const unsigned char * data, std::size_t size);
+
+        // the filter in a portable binary format, for use with view()
+        std::vector<unsigned char> serialize() const;
+
+        // the number of distinct keys the filter was built from
+        std::size_t size() const { return static_cast<std::size_t>(keyCount_); }
+
+        bool mayContain(std::uint64_t key) const;
+        bool mayContainTxid(const unsigned char * txid) const;
+        bool mayContain(const Coordinates & coordinates) const;
+
+        // the key for a string that is a txid (see parseTxid()) or a txref or txref-ext
+        // (anything decode() accepts, checksum included). Returns false for anything else.
+        // Does not allocate.
+        static bool inputKey(const std::string & input, std::uint64_t & key);
+
+        // looks up a string as inputKey() reads it. Returns false if it is neither a txid
+        // nor a txref.
+        bool mayContain(const std::string & input) const;
+
+    private:
+        const unsigned char * fingerprints() const {
+            return external_ != nullptr ? external_ : storage_.data();
+        }
+
+        std::uint64_t seed_ = 0;
+        std::uint64_t keyCount_ = 0;
+        std::uint32_t segmentLength_ = 0;
+        std::uint32_t segmentCount_ = 0;
+        std::uint32_t arrayLength_ = 0;
+        std::vector<unsigned char> storage_;          // fingerprints of a filter that was built
+        const unsigned char * external_ = nullptr;    // fingerprints of a filter that is viewed
+    };
+
 
     namespace limits {
 
@@ -122,9 +279,332 @@ namespace txref {
         const int TXREF_MAX_LENGTH =
                 TXREF_EXT_STRING_MIN_LENGTH_TESTNET + TXREF_EXT_EXTRA_PRETTY_PRINT_CHARS;
 
+        const int BECH32_MAX_LENGTH = 90;                          // longest bech32 string, see BIP-0173
+
+        const int TXREF_MAX_SEPARATOR_CHARS = 64;                  // most non-bech32 chars (ex: ':', '-', ' ')
+                                                                   // allowed in an input to decode
+
+        const int TXREF_MAX_INPUT_LENGTH =                         // longer inputs are rejected without being scanned
+                BECH32_MAX_LENGTH + TXREF_MAX_SEPARATOR_CHARS;
+
+        const int TXID_LENGTH = 64;                                // hex chars in a txid
+        const int TXID_SIZE = 32;                                  // bytes in a decoded txid
+
+        const int TXREF_BUFFER_SIZE = TXREF_MAX_LENGTH + 1;        // room for any txref plus a null terminator
+
+        const int BLOCK_HEADER_SIZE = 80;                          // bytes in a serialized block header
+
     }
+
+
+    // the number of transactions and outputs in a serialized block, as found by scanBlock()
+    struct BlockSummary {
+        std::size_t transactionCount = 0;
+        std::size_t outputCount = 0;
+    };
+
+    // the txid and txref of one transaction in a serialized block, as written by encodeBlock()
+    struct BlockTransaction {
+        unsigned char txid[limits::TXID_SIZE];          // reversed byte order, same as parseTxid()
+        char txref[limits::TXREF_BUFFER_SIZE];          // null-terminated
+        std::size_t outputCount;                        // number of outputs of the transaction
+        std::size_t firstOutput;                        // index of its first txref-ext in the outputs buffer
+    };
+
+    // walks a serialized block (header, transaction count, then transactions, with or
+    // without witness data) and counts its transactions and outputs, without hashing or
+    // copying anything. Use it to size the buffers passed to encodeBlock(). Throws if the
+    // block is truncated or malformed.
+    BlockSummary scanBlock(const unsigned char * block, std::size_t blockSize);
+
+    // walks a serialized block in place, the way scanBlock() does, and for each transaction
+    // writes its txid and its txref into transactions[i]. If outputs is not null, also
+    // writes a null-terminated txref-ext for every output into consecutive slots of
+    // limits::TXREF_BUFFER_SIZE chars, starting at transactions[i].firstOutput. magicCode
+    // selects the network and must be one of the non-extended magic codes. Returns the
+    // number of transactions. Throws if the block is malformed, a coordinate is out of
+    // range, or a buffer is too small.
+    std::size_t encodeBlock(
+            const unsigned char * block,
+            std::size_t blockSize,
+            int blockHeight,
+            BlockTransaction * transactions,
+            std::size_t maxTransactions,
+            char * outputs = nullptr,
+            std::size_t maxOutputs = 0,
+            int magicCode = MAGIC_CODE_MAIN,
+            Style style = Style::pretty
+    );
+
+
+    // block timestamps and median-time-past by height, for turning time ranges into height
+    // ranges and for adding times to decoded txrefs. Uses 16 bytes per block. Build it once
+    // from block headers, save it with serialize(), and later query the saved bytes in
+    // place with view(), for example from a mapped file.
+    class BlockTimeIndex {
+    public:
+        // an empty index, which knows no heights
+        BlockTimeIndex() = default;
+
+        // from 'count' consecutive 80-byte block headers, starting with the genesis block.
+        // magicCode is the (non-extended) magic code of the network the headers belong to.
+        // Throws if the headers don't form a chain, or if their timestamps make
+        // median-time-past decrease, which consensus rules out.
+        static BlockTimeIndex fromHeaders(
+                const unsigned char * headers,
+                std::size_t count,
+                int magicCode = MAGIC_CODE_MAIN);
+
+        // from 80-byte block headers in any order, which may include stale blocks, blocks
+        // that don't connect, and duplicates, such as the headers in a node's blk*.dat files.
+        // Follows the chain with the most work from the genesis block (the header whose
+        // previous block hash is all zeros). Throws if there is no genesis block, or if
+        // median-time-past decreases along that chain.
+        static BlockTimeIndex fromUnorderedHeaders(
+                const unsigned char * headers,
+                std::size_t count,
+                int magicCode = MAGIC_CODE_MAIN);
+
+        // checks an index previously written by serialize() and queries it in place. The
+        // data is not copied, so it must outlive the returned index and any copies of it.
+        // Throws if the data is not a valid index.
+        static BlockTimeIndex view(const unsigned char * data, std::size_t size);
+
+        // the index in a portable binary format, for use with view()
+        std::vector<unsigned char> serialize() const;
+
+        // the number of blocks in the index, which is one more than the height of its tip
+        std::size_t size() const { return static_cast<std::size_t>(count_); }
+
+        // the non-extended magic code of the network the index was built for
+        int magicCode() const { return magicCode_; }
+
+        // the times of a block. Throw if the height is not in the index.
+        std::uint32_t blockTime(int blockHeight) const;
+        std::uint32_t medianTimePast(int blockHeight) const;
+
+        // the heights [first, second) of a range that includes every block with a timestamp
+        // in [begin, end). Block timestamps are not strictly ordered, so the range may also
+        // include a few blocks with timestamps just outside; check blockTime() if that matters.
+        // Returns an empty range if there are no such blocks.
+        std::pair<int, int> heightRange(std::uint32_t begin, std::uint32_t end) const;
+
+        // the heights [first, second) of exactly the blocks with a median-time-past in
+        // [begin, end). Median-time-past never decreases, which fromHeaders() checks, so no
+        // blocks are included by mistake. For an index from view() whose data was not written
+        // by serialize(), the range is unspecified.
+        std::pair<int, int> heightRangeByMedianTime(std::uint32_t begin, std::uint32_t end) const;
+
+    private:
+        static BlockTimeIndex fromTimes(const std::vector<std::uint32_t> & times, int magicCode);
+
+        std::uint32_t value(int column, std::size_t blockHeight) const;
+
+        const unsigned char * data() const {
+            return external_ != nullptr ? external_ : storage_.data();
+        }
+
+        std::uint32_t count_ = 0;
+        int magicCode_ = MAGIC_CODE_MAIN;
+        std::vector<unsigned char> storage_;          // serialized form of an index that was built
+        const unsigned char * external_ = nullptr;    // serialized form of an index that is viewed
+    };
+
+    // decodes a txref like decode(txref), and also fills in the block's timestamp and
+    // median-time-past if the index is for the txref's network and has its block height
+    DecodedResult decode(const std::string & txref, const BlockTimeIndex & times);
+
+    // the totals for one group of txrefs, see TxrefAggregator
+    struct TxrefGroup {
+        int firstHeight = 0;         // first block height of the group's bucket
+        int magicCode = 0;           // non-extended magic code of the group's network
+        bool extended = false;       // txref-exts (true) or txrefs (false)
+        std::uint64_t count = 0;
+        // distinct transactions, and for txref-exts distinct outputs. Exact up to 384 per
+        // group, then estimated with about 1.6% standard error.
+        std::uint64_t distinctTransactions = 0;
+        std::uint64_t distinctOutputs = 0;
+        int minHeight = 0;
+        int maxHeight = 0;
+        int minTransactionIndex = 0;
+        int maxTransactionIndex = 0;
+        int minTxoIndex = 0;
+        int maxTxoIndex = 0;
+        // txref-exts by the bit length of their txo index: [0] counts txo index 0,
+        // [1] counts 1, [2] counts 2-3, [3] counts 4-7, ... [15] counts 16384-32767
+        std::uint64_t txoHistogram[16] = {};
+    };
+
+    // streaming group-by over txrefs: groups them by block height bucket, network and
+    // extended or not, and keeps a count, distinct counts and min/max values per group.
+    // Memory depends only on the number of groups, never on the number of txrefs added:
+    // each distinct count takes about 16 bytes per value up to 384 values, then 4 KB,
+    // so a group of txref-exts can take about 8 KB. With a bucket size of 1, every block
+    // of a long chain has its own group, so choose a larger one for whole-chain inputs.
+    // Not thread safe: give each thread its own aggregator and merge() them at the end.
+    class TxrefAggregator {
+    public:
+        // bucketSize is the number of block heights per group. Throws if it is less than 1.
+        explicit TxrefAggregator(int bucketSize = 1);
+        ~TxrefAggregator();
+        TxrefAggregator(TxrefAggregator &&) noexcept;
+        TxrefAggregator & operator=(TxrefAggregator &&) noexcept;
+
+        // adds a txref or txref-ext (anything decode() accepts, checksum included). Returns
+        // false, and counts it in invalidCount(), if it is not one. Does not allocate,
+        // except when the txref starts a new group.
+        bool add(const char * txref, std::size_t length);
+        bool add(const std::string & txref);
+
+        // adds the coordinates of a txref. Throws if they are out of range.
+        void add(const Coordinates & coordinates);
+
+        // adds everything another aggregator has seen. Throws if its bucket size differs.
+        void merge(const TxrefAggregator & other);
+
+        // the groups seen so far, ordered by first height, then magic code, then extended
+        std::vector<TxrefGroup> groups() const;
+
+        int bucketSize() const;
+
+        // the number of inputs rejected by add()
+        std::uint64_t invalidCount() const;
+
+    private:
+        struct State;
+        std::unique_ptr<State> state_;
+    };
+
+    // one line of a file read by decodeFile()
+    struct DecodedLine {
+        Coordinates coordinates;
+        bool valid = false;   // false if the line is not a txref; coordinates are then left at their defaults
+    };
+
+    // receives the lines of a file in order. firstLine is the (0-based) line number of lines[0].
+    typedef std::function<void(std::uint64_t firstLine, const DecodedLine * lines, std::size_t count)>
+            DecodedLinesHandler;
+
+    struct FileDecodeOptions {
+        unsigned int threads = 0;          // decoding threads, 0 for one per core
+        std::size_t readSize = 4u << 20u;  // bytes per read, rounded up to a multiple of 4096
+        unsigned int readsInFlight = 4;    // reads kept queued at once when io_uring is used
+        bool directIo = false;             // read with O_DIRECT, bypassing the page cache, if the
+                                           // file system allows it
+        bool ioUring = true;               // use io_uring if the kernel allows it, else pread()
+    };
+
+    struct FileDecodeStats {
+        std::uint64_t bytes = 0;
+        std::uint64_t lines = 0;
+        std::uint64_t invalidLines = 0;
+        bool usedIoUring = false;
+        bool usedDirectIo = false;
+    };
+
+    // decodes a file with one txref per line (anything decode() accepts, checksum included;
+    // blank lines are invalid lines). Reads the file in large blocks, with io_uring and
+    // several reads in flight where available, while worker threads decode blocks that have
+    // arrived. Lines that span blocks are put back together. The handler is called on a
+    // worker thread, one call at a time, in file order. Exceptions from the handler stop the
+    // decoding and are rethrown. Throws if the file can't be read. POSIX only.
+    // If decoding fails and the io_uring reads still in flight can't then be waited for,
+    // the read buffers ((readsInFlight + threads) * readSize bytes) are leaked rather than
+    // freed while the kernel may still write into them.
+    FileDecodeStats decodeFile(
+            const std::string & path,
+            const DecodedLinesHandler & handler,
+            const FileDecodeOptions & options = FileDecodeOptions());
 }
 
+// std::format and {fmt} support for txref::Coordinates. Both write straight into the
+// formatter's output iterator. Format specs: 'p' pretty (default), 'c' compact,
+// 'u' uppercase. Specs may be combined, ex: "{:cu}".
+
+#if __cplusplus >= 201402L
+#define TXREF_CONSTEXPR14 constexpr
+#else
+#define TXREF_CONSTEXPR14
+#endif
+
+namespace txref {
+namespace detail {
+
+    // parses the format spec shared by the std::format and {fmt} formatters
+    template<typename Iterator>
+    TXREF_CONSTEXPR14 Iterator parseFormatSpec(Iterator it, Iterator end, Style & style, bool & uppercase, bool & ok) {
+        ok = true;
+        for(; it != end && *it != '}'; ++it) {
+            switch(*it) {
+                case 'p': style = Style::pretty; break;
+                case 'c': style = Style::compact; break;
+                case 'u': uppercase = true; break;
+                default: ok = false; return it;
+            }
+        }
+        return it;
+    }
+
+}
+}
+
+#if __cplusplus >= 202002L
+#include <version>
+#endif
+
+#ifdef __cpp_lib_format
+#include <format>
+#include <algorithm>
+
+template<>
+struct std::formatter<txref::Coordinates, char> {
+    txref::Style style = txref::Style::pretty;
+    bool uppercase = false;
+
+    constexpr auto parse(std::format_parse_context & ctx) {
+        bool ok = true;
+        auto it = txref::detail::parseFormatSpec(ctx.begin(), ctx.end(), style, uppercase, ok);
+        if(!ok)
+            throw std::format_error("invalid format spec for txref::Coordinates");
+        return it;
+    }
+
+    template<typename FormatContext>
+    auto format(const txref::Coordinates & coordinates, FormatContext & ctx) const {
+        char buffer[txref::limits::TXREF_MAX_LENGTH];
+        auto length = txref::encodeTo(buffer, sizeof(buffer), coordinates, style, uppercase);
+        return std::copy_n(buffer, length, ctx.out());
+    }
+};
+#endif // #ifdef __cpp_lib_format
+
+#ifdef FMT_VERSION // only when <fmt/format.h> was included before this header
+#include <algorithm>
+
+template<>
+struct fmt::formatter<txref::Coordinates, char> {
+    txref::Style style = txref::Style::pretty;
+    bool uppercase = false;
+
+    FMT_CONSTEXPR auto parse(fmt::format_parse_context & ctx) -> decltype(ctx.begin()) {
+        bool ok = true;
+        auto it = txref::detail::parseFormatSpec(ctx.begin(), ctx.end(), style, uppercase, ok);
+        if(!ok)
+            throw fmt::format_error("invalid format spec for txref::Coordinates");
+        return it;
+    }
+
+    template<typename FormatContext>
+    auto format(const txref::Coordinates & coordinates, FormatContext & ctx) const -> decltype(ctx.out()) {
+        char buffer[txref::limits::TXREF_MAX_LENGTH];
+        auto length = txref::encodeTo(buffer, sizeof(buffer), coordinates, style, uppercase);
+        return std::copy_n(buffer, length, ctx.out());
+    }
+};
+#endif // #ifdef FMT_VERSION
+
+#undef TXREF_CONSTEXPR14
+
 #endif // #ifdef __cplusplus
 
 // C bindings - structs and functions
@@ -133,6 +613,7 @@ namespace txref {
 #include <stddef.h>
 #include <stdbool.h>
 #endif
+#include <stdint.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -181,6 +662,7 @@ typedef enum txref_error_e
     E_TXREF_NULL_ARGUMENT,
     E_TXREF_LENGTH_TOO_SHORT,
     E_TXREF_NO_MEMORY,
+    E_TXREF_INVALID_ARGUMENT,
     E_TXREF_MAX_ERROR
 } txref_error;
 
@@ -315,6 +797,149 @@ extern txref_error txref_decode(
         txref_DecodedResult *decodedResult,
         const char * txref);
 
+/**
+ * Room for any txref plus a '\0', in chars. Each output slot of txref_submit_encode() has
+ * this size.
+ */
+#define TXREF_C_BUFFER_SIZE 31
+
+/**
+ * The position of a confirmed bitcoin transaction (or one of its outputs), along with the
+ * magic code of its network. The magic code also selects between a txref and a txref-ext.
+ */
+typedef struct txref_coordinates_s {
+    int blockHeight;
+    int transactionIndex;
+    int txoIndex;
+    int magicCode;
+} txref_coordinates;
+
+/**
+ * A pool of worker threads that encodes and decodes arrays of txrefs in the background.
+ */
+typedef struct txref_context_s txref_context;
+
+/**
+ * Called on a worker thread when a job has finished and all of its outputs are written.
+ *
+ * @param jobId the id of the job, as returned by txref_submit_encode() or txref_submit_decode()
+ * @param failures the number of items whose error is not E_TXREF_SUCCESS
+ * @param userData the pointer given when the job was submitted
+ */
+typedef void (*txref_job_callback)(uint64_t jobId, size_t failures, void * userData);
+
+/**
+ * A finished job, as returned by txref_completed_jobs()
+ */
+typedef struct txref_job_result_s {
+    uint64_t jobId;
+    size_t failures;
+    void * userData;
+} txref_job_result;
+
+/**
+ * Starts a pool of worker threads.
+ *
+ * This memory must be freed using txref_free_context().
+ *
+ * @param threads the number of worker threads, or 0 for one per core
+ *
+ * @return a pointer to a new txref_context, or NULL if error
+ */
+extern txref_context * txref_create_context(unsigned int threads);
+
+/**
+ * Waits for every submitted job to finish (and its callback to return), then stops the
+ * worker threads and frees the context. Must not be called from a callback.
+ *
+ * @param context pointer to a txref_context, may be NULL
+ */
+extern void txref_free_context(txref_context * context);
+
+/**
+ * Returns a file descriptor that becomes readable when jobs submitted without a callback
+ * finish, for use with poll(), epoll or an event loop. Call txref_completed_jobs() when it
+ * is readable; that also resets it. Do not read or close the descriptor.
+ *
+ * @param context pointer to a txref_context
+ *
+ * @return the file descriptor, or -1 if there is none (on platforms without pipes)
+ */
+extern int txref_context_fd(txref_context * context);
+
+/**
+ * Encodes an array of coordinates in the background. Returns as soon as the job is queued.
+ * The arrays must stay valid, and must not be touched, until the job has finished.
+ *
+ * @param context pointer to a txref_context
+ * @param inputs the coordinates to encode
+ * @param count the number of coordinates
+ * @param compact if true, the txrefs are written without ':' and '-' separators
+ * @param outputs count * TXREF_C_BUFFER_SIZE chars. Slot i gets the NULL-terminated txref
+ *        for inputs[i], or an empty string if it can't be encoded.
+ * @param errors count error codes. errors[i] is E_TXREF_SUCCESS, or E_TXREF_INVALID_ARGUMENT
+ *        if inputs[i] is out of range.
+ * @param callback called when the job finishes, or NULL to report the job through
+ *        txref_context_fd() and txref_completed_jobs() instead
+ * @param userData passed to the callback, or returned by txref_completed_jobs()
+ * @param jobId set to the id of the new job, may be NULL
+ *
+ * @return E_TXREF_SUCCESS if the job was queued, others on error
+ */
+extern txref_error txref_submit_encode(
+        txref_context * context,
+        const txref_coordinates * inputs,
+        size_t count,
+        bool compact,
+        char * outputs,
+        txref_error * errors,
+        txref_job_callback callback,
+        void * userData,
+        uint64_t * jobId);
+
+/**
+ * Decodes an array of txrefs in the background. Returns as soon as the job is queued.
+ * The arrays, and the strings they point to, must stay valid until the job has finished.
+ *
+ * @param context pointer to a txref_context
+ * @param inputs pointers to NULL-terminated txrefs or txref-exts
+ * @param count the number of txrefs
+ * @param outputs count coordinates. outputs[i] is set for each valid inputs[i].
+ * @param errors count error codes. errors[i] is E_TXREF_SUCCESS, E_TXREF_NULL_ARGUMENT if
+ *        inputs[i] is NULL, or E_TXREF_INVALID_ARGUMENT if it is not a valid txref.
+ * @param callback called when the job finishes, or NULL to report the job through
+ *        txref_context_fd() and txref_completed_jobs() instead
+ * @param userData passed to the callback, or returned by txref_completed_jobs()
+ * @param jobId set to the id of the new job, may be NULL
+ *
+ * @return E_TXREF_SUCCESS if the job was queued, others on error
+ */
+extern txref_error txref_submit_decode(
+        txref_context * context,
+        const char * const * inputs,
+        size_t count,
+        txref_coordinates * outputs,
+        txref_error * errors,
+        txref_job_callback callback,
+        void * userData,
+        uint64_t * jobId);
+
+/**
+ * Collects jobs that were submitted without a callback and have finished since the last
+ * call, in the order they finished. Never blocks. May return 0 after the descriptor from
+ * txref_context_fd() was readable.
+ *
+ * @param context pointer to a txref_context
+ * @param results where to copy the finished jobs
+ * @param maxResults the size of results. Jobs that don't fit are kept for the next call.
+ *
+ * @return the number of jobs copied into results
+ */
+extern size_t txref_completed_jobs(
+        txref_context * context,
+        txref_job_result * results,
+        size_t maxResults);
+
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,16 @@
+#ifndef BECH32_STUB_H
+#define BECH32_STUB_H
+#ifdef __cplusplus
+#include <string>
+#include <vector>
+namespace bech32 {
+    const char separator = '1';
+    namespace limits { const size_t MAX_HRP_LENGTH = 83; const size_t MAX_BECH32_LENGTH = 90; }
+    enum Encoding { Invalid, Bech32, Bech32m };
+    struct DecodedResult { Encoding encoding = Invalid; std::string hrp; std::vector<unsigned char> dp; };
+    std::string stripUnknownChars(const std::string & bstring);
+    std::string encode(const std::string & hrp, const std::vector<unsigned char> & dp, Encoding encoding = Bech32m);
+    DecodedResult decode(const std::string & bstring);
+}
+#endif
+#endif
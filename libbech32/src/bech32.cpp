@@ -0,0 +1,69 @@
+#include "libbech32.h"
+#include <stdexcept>
+#include <cctype>
+#include <algorithm>
+namespace {
+const char charset[] = "qpzry9x8gf2tvdw0s3jn54khce6mua7l";
+uint32_t polymod(const std::vector<unsigned char> &v) {
+    uint32_t c = 1;
+    for (auto v_i : v) {
+        uint8_t c0 = c >> 25;
+        c = ((c & 0x1ffffff) << 5) ^ v_i;
+        if (c0 & 1) c ^= 0x3b6a57b2; if (c0 & 2) c ^= 0x26508e6d; if (c0 & 4) c ^= 0x1ea119fa;
+        if (c0 & 8) c ^= 0x3d4233dd; if (c0 & 16) c ^= 0x2a1462b3;
+    }
+    return c;
+}
+std::vector<unsigned char> expand(const std::string &hrp) {
+    std::vector<unsigned char> r;
+    for (char c : hrp) r.push_back(static_cast<unsigned char>(c) >> 5);
+    r.push_back(0);
+    for (char c : hrp) r.push_back(static_cast<unsigned char>(c) & 31);
+    return r;
+}
+}
+namespace bech32 {
+std::string stripUnknownChars(const std::string &s) {
+    std::string r;
+    for (char c : s) {
+        char l = static_cast<char>(::tolower(c));
+        if (l == separator || std::string(charset).find(l) != std::string::npos) r.push_back(c);
+    }
+    return r;
+}
+std::string encode(const std::string &hrp, const std::vector<unsigned char> &dp, Encoding e) {
+    if (hrp.size() > limits::MAX_HRP_LENGTH) throw std::runtime_error("HRP too long");
+    std::vector<unsigned char> v = expand(hrp);
+    v.insert(v.end(), dp.begin(), dp.end());
+    v.insert(v.end(), 6, 0);
+    uint32_t mod = polymod(v) ^ (e == Bech32m ? 0x2bc830a3 : 1);
+    std::string r = hrp + separator;
+    for (auto d : dp) r += charset[d];
+    for (int i = 0; i < 6; ++i) r += charset[(mod >> (5 * (5 - i))) & 31];
+    return r;
+}
+DecodedResult decode(const std::string &in) {
+    DecodedResult res;
+    bool lo = false, up = false;
+    for (char c : in) { if (::islower(c)) lo = true; if (::isupper(c)) up = true; }
+    if (lo && up) return res;
+    std::string s = in;
+    std::transform(s.begin(), s.end(), s.begin(), ::tolower);
+    auto pos = s.rfind(separator);
+    if (pos == std::string::npos || pos < 1 || pos + 7 > s.size() || s.size() > limits::MAX_BECH32_LENGTH) return res;
+    std::string hrp = s.substr(0, pos);
+    std::vector<unsigned char> values;
+    for (size_t i = pos + 1; i < s.size(); ++i) {
+        auto p = std::string(charset).find(s[i]);
+        if (p == std::string::npos) return res;
+        values.push_back(static_cast<unsigned char>(p));
+    }
+    std::vector<unsigned char> v = expand(hrp);
+    v.insert(v.end(), values.begin(), values.end());
+    uint32_t m = polymod(v);
+    if (m == 1) res.encoding = Bech32; else if (m == 0x2bc830a3) res.encoding = Bech32m; else return res;
+    res.hrp = hrp;
+    res.dp.assign(values.begin(), values.end() - 6);
+    return res;
+}
+}
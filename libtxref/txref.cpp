@@ -5,7 +5,46 @@
 #include <vector>
 #include <stdexcept>
 #include <sstream>
+#include <ostream>
 #include <cassert>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <limits>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TXREF_USE_SSE2
+#include <emmintrin.h>
+#endif
+
+// txref_context_fd() is an eventfd on Linux and a pipe on other POSIX systems, and
+// decodeFile() reads with pread(), or with io_uring where the kernel headers have it
+#if defined(__unix__) || defined(__APPLE__)
+#define TXREF_USE_POSIX
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define TXREF_USE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
+#endif
+#endif
+#endif
 
 namespace {
 
@@ -352,11 +391,429 @@ namespace {
         return output;
     }
 
-    InputParam classifyInputStringBase(const std::string & str) {
+    const char BECH32_CHARSET[]        = "qpzry9x8gf2tvdw0s3jn54khce6mua7l";
+
+    // reverse lookup of BECH32_CHARSET, for both cases. -1 for chars not in the charset
+    const int8_t BECH32_CHARSET_REV[128] = {
+            -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+            -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+            -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+            15, -1, 10, 17, 21, 20, 26, 30,  7,  5, -1, -1, -1, -1, -1, -1,
+            -1, 29, -1, 24, 13, 25,  9,  8, 23, -1, 18, 22, 31, 27, 19, -1,
+             1,  0,  3, 16, 11, 28, 12, 14,  6,  4,  2, -1, -1, -1, -1, -1,
+            -1, 29, -1, 24, 13, 25,  9,  8, 23, -1, 18, 22, 31, 27, 19, -1,
+             1,  0,  3, 16, 11, 28, 12, 14,  6,  4,  2, -1, -1, -1, -1, -1
+    };
+
+    const uint32_t BECH32_CONST        = 1;
+
+    const uint32_t BECH32M_CONST       = 0x2bc830a3;
+
+    const int CHECKSUM_SIZE            = 6;
+
+    const std::size_t MAX_CLEAN_LENGTH = static_cast<std::size_t>(BECH32_MAX_LENGTH);
+
+    // the xor of the bech32 generator constants selected by each bit of a 5-bit value, so
+    // a checksum step needs one lookup instead of five data-dependent branches
+    const uint32_t POLYMOD_GENERATORS[32] = {
+            0x00000000u, 0x3B6A57B2u, 0x26508E6Du, 0x1D3AD9DFu,
+            0x1EA119FAu, 0x25CB4E48u, 0x38F19797u, 0x039BC025u,
+            0x3D4233DDu, 0x0628646Fu, 0x1B12BDB0u, 0x2078EA02u,
+            0x23E32A27u, 0x18897D95u, 0x05B3A44Au, 0x3ED9F3F8u,
+            0x2A1462B3u, 0x117E3501u, 0x0C44ECDEu, 0x372EBB6Cu,
+            0x34B57B49u, 0x0FDF2CFBu, 0x12E5F524u, 0x298FA296u,
+            0x1756516Eu, 0x2C3C06DCu, 0x3106DF03u, 0x0A6C88B1u,
+            0x09F74894u, 0x329D1F26u, 0x2FA7C6F9u, 0x14CD914Bu
+    };
+
+    // one step of the bech32 checksum calculation, see BIP-0173
+    uint32_t polymodStep(uint32_t chk, uint8_t value) {
+        uint32_t top = chk >> 25u;
+        return (((chk & 0x1FFFFFFu) << 5u) ^ value) ^ POLYMOD_GENERATORS[top];
+    }
 
-        // before testing for various txrefs, get rid of any unknown
-        // characters, ex: dashes, periods
-        std::string s = bech32::stripUnknownChars(str);
+    // feed the expanded HRP into the bech32 checksum
+    uint32_t polymodHrp(const char * hrp, std::size_t hrplen) {
+        uint32_t chk = 1;
+        for(std::size_t i = 0; i < hrplen; ++i)
+            chk = polymodStep(chk, static_cast<uint8_t>(static_cast<unsigned char>(hrp[i]) >> 5u));
+        chk = polymodStep(chk, 0);
+        for(std::size_t i = 0; i < hrplen; ++i)
+            chk = polymodStep(chk, static_cast<uint8_t>(static_cast<unsigned char>(hrp[i]) & 0x1Fu));
+        return chk;
+    }
+
+    // is the magic code one of those used for extended txrefs?
+    bool isExtendedMagicCode(int magicCode) {
+        return magicCode == txref::MAGIC_CODE_MAIN_EXTENDED ||
+               magicCode == txref::MAGIC_CODE_TEST_EXTENDED ||
+               magicCode == txref::MAGIC_CODE_REGTEST_EXTENDED;
+    }
+
+    // the default HRP for the network that the magic code belongs to
+    const char * hrpForMagicCode(int magicCode) {
+        switch(magicCode) {
+            case txref::MAGIC_CODE_MAIN:
+            case txref::MAGIC_CODE_MAIN_EXTENDED:
+                return txref::BECH32_HRP_MAIN;
+            case txref::MAGIC_CODE_TEST:
+            case txref::MAGIC_CODE_TEST_EXTENDED:
+                return txref::BECH32_HRP_TEST;
+            case txref::MAGIC_CODE_REGTEST:
+            case txref::MAGIC_CODE_REGTEST_EXTENDED:
+                return txref::BECH32_HRP_REGTEST;
+            default:
+                throw std::runtime_error("magic code does not belong to a known network");
+        }
+    }
+
+    // pack the coordinates into a data part of DATA_SIZE or DATA_EXTENDED_SIZE 5-bit
+    // values. Same layout as txrefEncode() and txrefExtEncode(), but without allocating.
+    // Returns the number of values written.
+    std::size_t packDataPart(unsigned char * dp, const txref::Coordinates & coordinates) {
+        checkBlockHeightRange(coordinates.blockHeight);
+        checkTransactionIndexRange(coordinates.transactionIndex);
+        checkTxoIndexRange(coordinates.txoIndex);
+        checkMagicCodeRange(coordinates.magicCode);
+
+        auto bh = static_cast<uint32_t>(coordinates.blockHeight);
+        auto tp = static_cast<uint32_t>(coordinates.transactionIndex);
+        auto ti = static_cast<uint32_t>(coordinates.txoIndex);
+
+        dp[0] = static_cast<uint8_t>(coordinates.magicCode);
+        dp[1] = static_cast<uint8_t>((bh & 0xFu) << 1u);  // version bit is 0
+        dp[2] = static_cast<uint8_t>((bh & 0x1F0u) >> 4u);
+        dp[3] = static_cast<uint8_t>((bh & 0x3E00u) >> 9u);
+        dp[4] = static_cast<uint8_t>((bh & 0x7C000u) >> 14u);
+        dp[5] = static_cast<uint8_t>((bh & 0xF80000u) >> 19u);
+        dp[6] = static_cast<uint8_t>(tp & 0x1Fu);
+        dp[7] = static_cast<uint8_t>((tp & 0x3E0u) >> 5u);
+        dp[8] = static_cast<uint8_t>((tp & 0x7C00u) >> 10u);
+
+        if(!isExtendedMagicCode(coordinates.magicCode)) {
+            if(coordinates.txoIndex != 0)
+                throw std::runtime_error("magic code does not support extended txrefs");
+            return DATA_SIZE;
+        }
+
+        dp[9] = static_cast<uint8_t>(ti & 0x1Fu);
+        dp[10] = static_cast<uint8_t>((ti & 0x3E0u) >> 5u);
+        dp[11] = static_cast<uint8_t>((ti & 0x7C00u) >> 10u);
+        return DATA_EXTENDED_SIZE;
+    }
+
+    // the reverse of packDataPart(): the coordinates in a data part of DATA_SIZE or
+    // DATA_EXTENDED_SIZE 5-bit values
+    txref::Coordinates unpackDataPart(const unsigned char * dp, std::size_t dataSize) {
+        txref::Coordinates coordinates;
+        coordinates.magicCode = dp[0];
+        coordinates.blockHeight = (dp[1] >> 1) | (dp[2] << 4) | (dp[3] << 9) | (dp[4] << 14) | (dp[5] << 19);
+        coordinates.transactionIndex = dp[6] | (dp[7] << 5) | (dp[8] << 10);
+        if(dataSize == static_cast<std::size_t>(DATA_EXTENDED_SIZE))
+            coordinates.txoIndex = dp[9] | (dp[10] << 5) | (dp[11] << 10);
+        return coordinates;
+    }
+
+    char toUpperAscii(char c) {
+        return (c >= 'a' && c <= 'z') ? static_cast<char>(c - 'a' + 'A') : c;
+    }
+
+    // appends the bech32m checksum of hrp + data part to the data part. dp must have room
+    // for CHECKSUM_SIZE more values. Returns the new size of the data part.
+    std::size_t appendChecksum(
+            unsigned char * dp,
+            std::size_t dataSize,
+            const char * hrp,
+            std::size_t hrplen) {
+
+        uint32_t chk = polymodHrp(hrp, hrplen);
+        for(std::size_t i = 0; i < dataSize; ++i)
+            chk = polymodStep(chk, dp[i]);
+        for(int i = 0; i < CHECKSUM_SIZE; ++i)
+            chk = polymodStep(chk, 0);
+        chk ^= BECH32M_CONST;
+        for(int i = 0; i < CHECKSUM_SIZE; ++i)
+            dp[dataSize++] = static_cast<uint8_t>((chk >> (5u * static_cast<uint32_t>(CHECKSUM_SIZE - 1 - i))) & 0x1Fu);
+        return dataSize;
+    }
+
+    // the number of chars writeTxref() will produce
+    std::size_t txrefLength(std::size_t hrplen, std::size_t dataSize, txref::Style style) {
+        // colon plus a hyphen every 4 chars, same as prettyPrint()
+        std::size_t separators = style == txref::Style::pretty ? 1 + (dataSize - 1) / 4 : 0;
+        return hrplen + 1 + dataSize + separators;
+    }
+
+    // writes hrp + separator + data part (which includes the checksum) as a txref string.
+    // Returns the number of chars written. Throws if the output buffer is too short.
+    std::size_t writeTxref(
+            char * out,
+            std::size_t outlen,
+            const char * hrp,
+            std::size_t hrplen,
+            const unsigned char * dp,
+            std::size_t dataSize,
+            txref::Style style,
+            bool uppercase) {
+
+        std::size_t length = txrefLength(hrplen, dataSize, style);
+        if(outlen < length)
+            throw std::runtime_error("output buffer is too short");
+
+        char * pos = out;
+        for(std::size_t i = 0; i < hrplen; ++i)
+            *pos++ = uppercase ? toUpperAscii(hrp[i]) : hrp[i];
+        *pos++ = bech32::separator;
+        if(style == txref::Style::pretty)
+            *pos++ = txref::colon;
+        for(std::size_t i = 0; i < dataSize; ++i) {
+            if(style == txref::Style::pretty && i > 0 && i % 4 == 0)
+                *pos++ = txref::hyphen;
+            char c = BECH32_CHARSET[dp[i]];
+            *pos++ = uppercase ? toUpperAscii(c) : c;
+        }
+
+        assert(static_cast<std::size_t>(pos - out) == length);
+        return length;
+    }
+
+    // a txref that has been cleaned, given an HRP if it was missing, and had its checksum
+    // verified. Everything is held in fixed-size buffers.
+    struct ParsedTxref {
+        char hrp[MAX_CLEAN_LENGTH];
+        std::size_t hrplen = 0;
+        unsigned char dp[MAX_CLEAN_LENGTH];   // data part, followed by the checksum
+        std::size_t dataSize = 0;             // not including the checksum
+        txref::Encoding encoding = txref::Encoding::Invalid;
+    };
+
+    // the value of a char in the bech32 charset (either case), or -1 if it is not in the charset
+    int charsetValue(char c) {
+        auto u = static_cast<unsigned char>(c);
+        return u < 128 ? BECH32_CHARSET_REV[u] : -1;
+    }
+
+    // parses a txref in a single pass over the input. Behaves like the decode() path:
+    // unknown chars are skipped (see bech32::stripUnknownChars()), case is ignored and a
+    // missing HRP is added (see addHrpIfNeeded()). Returns false if the input is not a
+    // valid txref.
+    bool parseTxref(const char * str, std::size_t len, ParsedTxref & parsed) {
+
+        if(len > static_cast<std::size_t>(TXREF_MAX_INPUT_LENGTH))
+            return false;
+
+        char clean[MAX_CLEAN_LENGTH];
+        std::size_t cleanlen = 0;
+        std::size_t separatorPos = MAX_CLEAN_LENGTH; // position of the last separator, if any
+        std::size_t skipped = 0;
+
+        for(std::size_t i = 0; i < len; ++i) {
+            char c = str[i];
+            if(c == bech32::separator)
+                separatorPos = cleanlen;
+            else if(charsetValue(c) < 0) {
+                if(++skipped > static_cast<std::size_t>(TXREF_MAX_SEPARATOR_CHARS))
+                    return false;
+                continue;
+            }
+            if(cleanlen == MAX_CLEAN_LENGTH)
+                return false;
+            clean[cleanlen++] = c;
+        }
+
+        const char * data;
+        std::size_t datalen;
+        if(separatorPos == MAX_CLEAN_LENGTH) {
+            // no HRP. Pick one based on the first char, like addHrpIfNeeded()
+            if(!isLengthValid(cleanlen))
+                return false;
+            const char * hrp;
+            switch(clean[0]) {
+                case 'r': case 'y': case 'R': case 'Y':
+                    hrp = txref::BECH32_HRP_MAIN; break;
+                case 'x': case '8': case 'X':
+                    hrp = txref::BECH32_HRP_TEST; break;
+                case 'q': case 'p': case 'Q': case 'P':
+                    hrp = txref::BECH32_HRP_REGTEST; break;
+                default:
+                    return false;
+            }
+            parsed.hrplen = std::char_traits<char>::length(hrp);
+            std::copy_n(hrp, parsed.hrplen, parsed.hrp);
+            data = clean;
+            datalen = cleanlen;
+        }
+        else {
+            parsed.hrplen = separatorPos;
+            for(std::size_t i = 0; i < separatorPos; ++i)
+                parsed.hrp[i] = static_cast<char>(::tolower(clean[i]));
+            data = clean + separatorPos + 1;
+            datalen = cleanlen - separatorPos - 1;
+        }
+
+        if(parsed.hrplen == 0 || parsed.hrplen > bech32::limits::MAX_HRP_LENGTH)
+            return false;
+        if(datalen < static_cast<std::size_t>(CHECKSUM_SIZE) ||
+           !isDataSizeValid(datalen - static_cast<std::size_t>(CHECKSUM_SIZE)))
+            return false;
+
+        uint32_t chk = polymodHrp(parsed.hrp, parsed.hrplen);
+        for(std::size_t i = 0; i < datalen; ++i) {
+            int value = charsetValue(data[i]);
+            if(value < 0) // a separator char in the data part
+                return false;
+            parsed.dp[i] = static_cast<unsigned char>(value);
+            chk = polymodStep(chk, parsed.dp[i]);
+        }
+        parsed.dataSize = datalen - static_cast<std::size_t>(CHECKSUM_SIZE);
+
+        if(chk == BECH32M_CONST)
+            parsed.encoding = txref::Encoding::Bech32m;
+        else if(chk == BECH32_CONST)
+            parsed.encoding = txref::Encoding::Bech32;
+        else
+            return false;
+
+        // only version 0 txrefs are known, see extractVersion()
+        return (parsed.dp[1] & 0x1u) == 0;
+    }
+
+    // writes the canonical compact form of a txref accepted by parseTxref() into out:
+    // lower-case, with the full HRP, a bech32m checksum and no separators. Returns false,
+    // leaving out alone, if the input is not a valid txref.
+    bool normalizeInto(const std::string & txref, std::string & out) {
+        ParsedTxref parsed;
+        if(!parseTxref(txref.data(), txref.length(), parsed))
+            return false;
+
+        // replace an original bech32 checksum with a bech32m one
+        if(parsed.encoding != Encoding::Bech32m)
+            appendChecksum(parsed.dp, parsed.dataSize, parsed.hrp, parsed.hrplen);
+
+        std::size_t dataSize = parsed.dataSize + CHECKSUM_SIZE;
+        out.assign(txrefLength(parsed.hrplen, dataSize, Style::compact), '\0');
+        writeTxref(&out[0], out.length(), parsed.hrp, parsed.hrplen, parsed.dp, dataSize, Style::compact, false);
+        return true;
+    }
+
+    // index of the ostream word holding the txref::Style selected by the manipulators
+    int styleIndex() {
+        static const int index = std::ios_base::xalloc();
+        return index;
+    }
+
+#ifdef TXREF_USE_SSE2
+    // converts 16 hex chars to their 4-bit values. Sets valid to false if any char is
+    // not a hex digit.
+    __m128i hexNibbles16(__m128i chars, bool & valid) {
+        // folding to lower case doesn't affect digits, which already have bit 0x20 set
+        __m128i lower = _mm_or_si128(chars, _mm_set1_epi8(0x20));
+        __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(chars, _mm_set1_epi8('0' - 1)),
+                                      _mm_cmplt_epi8(chars, _mm_set1_epi8('9' + 1)));
+        __m128i letter = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)),
+                                       _mm_cmplt_epi8(lower, _mm_set1_epi8('f' + 1)));
+        valid = _mm_movemask_epi8(_mm_or_si128(digit, letter)) == 0xFFFF;
+
+        // '0'..'9' -> 0..9, 'a'..'f' -> 49..54 - 39 = 10..15
+        __m128i nibbles = _mm_sub_epi8(lower, _mm_set1_epi8('0'));
+        return _mm_sub_epi8(nibbles, _mm_and_si128(letter, _mm_set1_epi8(39)));
+    }
+
+    // combines pairs of nibbles (high first) into bytes: 16 nibbles -> 8 bytes in the low
+    // byte of each 16-bit lane
+    __m128i packNibblePairs(__m128i nibbles) {
+        __m128i high = _mm_slli_epi16(_mm_and_si128(nibbles, _mm_set1_epi16(0x00FF)), 4);
+        __m128i low = _mm_srli_epi16(nibbles, 8);
+        return _mm_or_si128(high, low);
+    }
+
+    bool parseTxidSse2(const char * hex, unsigned char * txid) {
+        __m128i bytes[2];
+        bool allValid = true;
+        for(int half = 0; half < 2; ++half) {
+            bool valid0, valid1;
+            const char * block = hex + 32 * half;
+            __m128i n0 = hexNibbles16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(block)), valid0);
+            __m128i n1 = hexNibbles16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(block + 16)), valid1);
+            allValid = allValid && valid0 && valid1;
+            bytes[half] = _mm_packus_epi16(packNibblePairs(n0), packNibblePairs(n1));
+        }
+        if(!allValid)
+            return false;
+        if(txid != nullptr) {
+            unsigned char decoded[TXID_SIZE];
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(decoded), bytes[0]);
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(decoded + 16), bytes[1]);
+            std::reverse_copy(decoded, decoded + TXID_SIZE, txid);
+        }
+        return true;
+    }
+#endif
+
+#if !defined(TXREF_USE_SSE2) || defined(TXREF_TESTING)
+    // value of a hex digit (either case), or -1 if the char is not a hex digit
+    int hexValue(char c) {
+        if(c >= '0' && c <= '9')
+            return c - '0';
+        if(c >= 'a' && c <= 'f')
+            return c - 'a' + 10;
+        if(c >= 'A' && c <= 'F')
+            return c - 'A' + 10;
+        return -1;
+    }
+
+    // the portable version of parseTxidHex(), which the tests also check parseTxidSse2()
+    // against. Like that one, it leaves txid alone unless all the chars are hex digits.
+    bool parseTxidScalar(const char * hex, unsigned char * txid) {
+        unsigned char decoded[TXID_SIZE];
+        for(int i = 0; i < TXID_SIZE; ++i) {
+            int hi = hexValue(hex[2 * i]);
+            int lo = hexValue(hex[2 * i + 1]);
+            if(hi < 0 || lo < 0)
+                return false;
+            decoded[TXID_SIZE - 1 - i] = static_cast<unsigned char>((hi << 4) | lo);
+        }
+        if(txid != nullptr)
+            std::copy(decoded, decoded + TXID_SIZE, txid);
+        return true;
+    }
+#endif
+
+    // checks that the TXID_LENGTH chars at hex are all hex digits and, if txid is not
+    // null, decodes them into TXID_SIZE bytes. Bytes are stored in reverse order, which is
+    // how txids appear inside serialized transactions and blocks.
+    bool parseTxidHex(const char * hex, unsigned char * txid) {
+#ifdef TXREF_USE_SSE2
+        return parseTxidSse2(hex, txid);
+#else
+        return parseTxidScalar(hex, txid);
+#endif
+    }
+
+    // checks, with a bounded amount of work, whether an input is small enough to possibly
+    // be a txref. Gives up as soon as it has seen more significant chars (those that
+    // bech32::stripUnknownChars() keeps) than the longest bech32 string, or more other
+    // chars than TXREF_MAX_SEPARATOR_CHARS. Inputs longer than TXREF_MAX_INPUT_LENGTH are
+    // rejected without looking at them at all.
+    bool isWithinInputBounds(const char * str, std::size_t len) {
+        if(len > static_cast<std::size_t>(TXREF_MAX_INPUT_LENGTH))
+            return false;
+
+        std::size_t significant = 0;
+        std::size_t skipped = 0;
+        for(std::size_t i = 0; i < len; ++i) {
+            if(str[i] == bech32::separator || charsetValue(str[i]) >= 0) {
+                if(++significant > static_cast<std::size_t>(BECH32_MAX_LENGTH))
+                    return false;
+            }
+            else if(++skipped > static_cast<std::size_t>(TXREF_MAX_SEPARATOR_CHARS))
+                return false;
+        }
+        return true;
+    }
+
+    // s must already have been cleaned by bech32::stripUnknownChars()
+    InputParam classifyInputStringBase(const std::string & s) {
 
         if(s.length() == TXREF_STRING_MIN_LENGTH ||
            s.length() == TXREF_STRING_MIN_LENGTH_TESTNET ||
@@ -371,11 +828,8 @@ namespace {
         return InputParam::unknown;
     }
 
-    InputParam classifyInputStringMissingHRP(const std::string & str) {
-
-        // before testing for various txrefs, get rid of any unknown
-        // characters, ex: dashes, periods
-        std::string s = bech32::stripUnknownChars(str);
+    // s must already have been cleaned by bech32::stripUnknownChars()
+    InputParam classifyInputStringMissingHRP(const std::string & s) {
 
         if(s.length() == TXREF_STRING_NO_HRP_MIN_LENGTH)
             return InputParam::txref;
@@ -386,6 +840,777 @@ namespace {
         return InputParam::unknown;
     }
 
+    // minimal incremental SHA-256 (FIPS 180-4), only used to compute txids from the
+    // pieces of a serialized transaction without copying them
+    class Sha256 {
+    public:
+        Sha256() = default;
+
+        void update(const unsigned char * data, std::size_t len) {
+            totalLength += len;
+            if(bufferLength > 0) {
+                std::size_t n = std::min(len, sizeof(buffer) - bufferLength);
+                std::memcpy(buffer + bufferLength, data, n);
+                bufferLength += n;
+                data += n;
+                len -= n;
+                if(bufferLength < sizeof(buffer))
+                    return;
+                transform(buffer);
+                bufferLength = 0;
+            }
+            for(; len >= sizeof(buffer); data += sizeof(buffer), len -= sizeof(buffer))
+                transform(data);
+            std::memcpy(buffer, data, len);
+            bufferLength = len;
+        }
+
+        void finish(unsigned char * digest) {
+            uint64_t bits = totalLength * 8;
+            static const unsigned char padding[64] = {0x80};
+            update(padding, 1 + ((119 - totalLength % 64) % 64));
+            unsigned char length[8];
+            for(int i = 0; i < 8; ++i)
+                length[i] = static_cast<unsigned char>(bits >> (56 - 8 * i));
+            update(length, sizeof(length));
+            for(int i = 0; i < 8; ++i)
+                for(int j = 0; j < 4; ++j)
+                    digest[4 * i + j] = static_cast<unsigned char>(state[i] >> (24 - 8 * j));
+        }
+
+    private:
+        static uint32_t rotr(uint32_t x, uint32_t n) {
+            return (x >> n) | (x << (32 - n));
+        }
+
+        void transform(const unsigned char * chunk) {
+            static const uint32_t k[64] = {
+                    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+                    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+                    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+                    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+                    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+                    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+                    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+                    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+            };
+
+            uint32_t w[64];
+            for(int i = 0; i < 16; ++i)
+                w[i] = static_cast<uint32_t>(chunk[4 * i]) << 24 | static_cast<uint32_t>(chunk[4 * i + 1]) << 16 |
+                       static_cast<uint32_t>(chunk[4 * i + 2]) << 8 | static_cast<uint32_t>(chunk[4 * i + 3]);
+            for(int i = 16; i < 64; ++i) {
+                uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+                uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+                w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+            }
+
+            uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+            uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+            for(int i = 0; i < 64; ++i) {
+                uint32_t t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + k[i] + w[i];
+                uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+                h = g;
+                g = f;
+                f = e;
+                e = d + t1;
+                d = c;
+                c = b;
+                b = a;
+                a = t1 + t2;
+            }
+            state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+            state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+        }
+
+        uint32_t state[8] = {
+                0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+        };
+        unsigned char buffer[64] = {};
+        std::size_t bufferLength = 0;
+        uint64_t totalLength = 0;
+    };
+
+    // a bounds-checked cursor over a serialized block. Reads in place, never copies.
+    struct BlockReader {
+        const unsigned char * pos;
+        const unsigned char * end;
+
+        std::size_t remaining() const {
+            return static_cast<std::size_t>(end - pos);
+        }
+
+        const unsigned char * skip(uint64_t n) {
+            if(n > remaining())
+                throw std::runtime_error("serialized block is truncated");
+            const unsigned char * start = pos;
+            pos += n;
+            return start;
+        }
+
+        uint8_t readByte() {
+            return *skip(1);
+        }
+
+        uint64_t readLittleEndian(int size) {
+            const unsigned char * p = skip(static_cast<uint64_t>(size));
+            uint64_t value = 0;
+            for(int i = size - 1; i >= 0; --i)
+                value = (value << 8u) | p[i];
+            return value;
+        }
+
+        // bitcoin's variable length integer ("CompactSize")
+        uint64_t readCompactSize() {
+            uint8_t first = readByte();
+            if(first < 0xFD)
+                return first;
+            if(first == 0xFD)
+                return readLittleEndian(2);
+            if(first == 0xFE)
+                return readLittleEndian(4);
+            return readLittleEndian(8);
+        }
+
+        // a count of items that each take at least one byte can't exceed what's left
+        uint64_t readCount() {
+            uint64_t count = readCompactSize();
+            if(count > remaining())
+                throw std::runtime_error("serialized block is truncated");
+            return count;
+        }
+    };
+
+    // walks one serialized transaction, leaving the reader just past it. If txid is not
+    // null, writes the double SHA-256 of the transaction without its witness data, hashing
+    // the pieces of the block in place. Returns the number of outputs.
+    std::size_t readTransaction(BlockReader & reader, unsigned char * txid) {
+        const unsigned char * version = reader.skip(4);
+
+        // BIP-0144: a zero input count (the marker) followed by flags means witness data follows
+        bool hasWitness = false;
+        if(reader.remaining() >= 2 && reader.pos[0] == 0x00) {
+            if(reader.pos[1] != 0x01)
+                throw std::runtime_error("transaction has unknown serialization flags");
+            reader.skip(2);
+            hasWitness = true;
+        }
+
+        const unsigned char * body = reader.pos;
+        uint64_t inputCount = reader.readCount();
+        for(uint64_t i = 0; i < inputCount; ++i) {
+            reader.skip(32 + 4);                     // previous output: txid and index
+            reader.skip(reader.readCompactSize());   // scriptSig
+            reader.skip(4);                          // sequence
+        }
+        uint64_t outputCount = reader.readCount();
+        for(uint64_t i = 0; i < outputCount; ++i) {
+            reader.skip(8);                          // value
+            reader.skip(reader.readCompactSize());   // scriptPubKey
+        }
+        const unsigned char * bodyEnd = reader.pos;
+
+        if(hasWitness) {
+            for(uint64_t i = 0; i < inputCount; ++i) {
+                uint64_t items = reader.readCount();
+                for(uint64_t j = 0; j < items; ++j)
+                    reader.skip(reader.readCompactSize());
+            }
+        }
+        const unsigned char * lockTime = reader.skip(4);
+
+        if(txid != nullptr) {
+            unsigned char digest[TXID_SIZE];
+            Sha256 first;
+            first.update(version, 4);
+            first.update(body, static_cast<std::size_t>(bodyEnd - body));
+            first.update(lockTime, 4);
+            first.finish(digest);
+
+            Sha256 second;
+            second.update(digest, sizeof(digest));
+            second.finish(txid);
+        }
+
+        return static_cast<std::size_t>(outputCount);
+    }
+
+    // the magic code used for txref-exts on the same network as a non-extended magic code
+    int extendedMagicCodeFor(int magicCode) {
+        switch(magicCode) {
+            case txref::MAGIC_CODE_MAIN:
+                return txref::MAGIC_CODE_MAIN_EXTENDED;
+            case txref::MAGIC_CODE_TEST:
+                return txref::MAGIC_CODE_TEST_EXTENDED;
+            case txref::MAGIC_CODE_REGTEST:
+                return txref::MAGIC_CODE_REGTEST_EXTENDED;
+            default:
+                throw std::runtime_error("magic code must be one of the non-extended magic codes");
+        }
+    }
+
+    // the double SHA-256 of a block header, in the byte order used inside headers
+    void blockHash(const unsigned char * header, unsigned char * hash) {
+        unsigned char digest[32];
+        Sha256 first;
+        first.update(header, BLOCK_HEADER_SIZE);
+        first.finish(digest);
+
+        Sha256 second;
+        second.update(digest, sizeof(digest));
+        second.finish(hash);
+    }
+
+    // where the fields used by BlockTimeIndex are in a block header
+    const int HEADER_PREVIOUS_HASH_OFFSET = 4;
+    const int HEADER_TIME_OFFSET = 68;
+    const int HEADER_BITS_OFFSET = 72;
+
+    // the expected number of hashes needed to find a block with the given compact target,
+    // 2^256 / target. A double is precise enough to compare the total work of two chains.
+    double blockWork(uint32_t bits) {
+        int exponent = static_cast<int>(bits >> 24u);
+        uint32_t mantissa = bits & 0x007FFFFFu;
+        if(mantissa == 0)
+            return 0.0;
+        return std::ldexp(1.0, 256 - 8 * (exponent - 3)) / mantissa;
+    }
+
+    // serialized BlockTimeIndex layout, all integers little-endian:
+    //   magic (8) | block count (4) | magic code (4) | then, for each column below, one
+    //   uint32 per block height
+    const unsigned char TIME_INDEX_MAGIC[8] = {'T', 'X', 'R', 'T', 'I', 'M', 'E', '1'};
+    const std::size_t TIME_INDEX_HEADER_SIZE = 16;
+    const int TIME_COLUMN = 0;           // block timestamp
+    const int MEDIAN_TIME_COLUMN = 1;    // median-time-past: median timestamp of the last 11 blocks
+    const int MAX_TIME_COLUMN = 2;       // latest timestamp at or below the height
+    const int MIN_TIME_COLUMN = 3;       // earliest timestamp at or above the height
+    const int TIME_INDEX_COLUMNS = 4;
+
+    // the first index in [0, count) for which value(index) >= target, given that value()
+    // never decreases, or count if there is none
+    template<typename Value>
+    std::size_t lowerBound(std::size_t count, uint32_t target, Value value) {
+        std::size_t first = 0;
+        while(count > 0) {
+            std::size_t step = count / 2;
+            if(value(first + step) < target) {
+                first += step + 1;
+                count -= step + 1;
+            }
+            else {
+                count = step;
+            }
+        }
+        return first;
+    }
+
+    // writes a null-terminated txref into a slot of TXREF_BUFFER_SIZE chars
+    void encodeIntoSlot(char * slot, const txref::Coordinates & coordinates, txref::Style style) {
+        std::size_t length = encodeTo(slot, TXREF_MAX_LENGTH, coordinates, style);
+        slot[length] = '\0';
+    }
+
+    // murmur3's 64-bit finalizer: every input bit affects every output bit
+    uint64_t mix64(uint64_t h) {
+        h ^= h >> 33u;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33u;
+        h *= 0xc4ceb9fe1a85ec53ULL;
+        h ^= h >> 33u;
+        return h;
+    }
+
+    uint64_t loadLittleEndian(const unsigned char * p, int size) {
+        uint64_t value = 0;
+        for(int i = size - 1; i >= 0; --i)
+            value = (value << 8u) | p[i];
+        return value;
+    }
+
+    void storeLittleEndian(unsigned char * p, uint64_t value, int size) {
+        for(int i = 0; i < size; ++i)
+            p[i] = static_cast<unsigned char>(value >> (8u * static_cast<unsigned int>(i)));
+    }
+
+    // serialized TxFilter layout, all integers little-endian:
+    //   magic (8) | seed (8) | key count (8) | segment length (4) | segment count (4) |
+    //   array length (4) | reserved, zero (4) | one fingerprint byte per slot (array length)
+    const unsigned char FILTER_MAGIC[8] = {'T', 'X', 'R', 'F', 'U', 'S', 'E', '1'};
+    const std::size_t FILTER_HEADER_SIZE = 40;
+
+    // binary fuse filter parameters, see Graf & Lemire, "Binary Fuse Filters: Fast and
+    // Smaller Than Xor Filters" (2022). Each key hashes to one slot in each of 3 consecutive
+    // segments, and the xor of those 3 slots is the key's 8-bit fingerprint.
+    const uint32_t FILTER_MAX_SEGMENT_LENGTH = 262144;
+    const int FILTER_MAX_ATTEMPTS = 100;
+    const uint64_t FILTER_FIRST_SEED = 0x7478726566ULL; // "txref"
+
+    // below this many keys, building a filter isn't worth starting threads for
+    const std::size_t FILTER_PARALLEL_MIN_KEYS = 1u << 16u;
+
+    void filterSlots(uint64_t hash, uint32_t segmentLength, uint32_t segmentCount, uint32_t slots[3]) {
+        // high 64 bits of hash * segmentCount * segmentLength, without needing 128-bit integers
+        uint64_t segmentCountLength = static_cast<uint64_t>(segmentCount) * segmentLength;
+        uint64_t high = (hash >> 32u) * segmentCountLength;
+        uint64_t low = ((hash & 0xFFFFFFFFu) * segmentCountLength) >> 32u;
+        auto h0 = static_cast<uint32_t>((high + low) >> 32u);
+
+        uint32_t mask = segmentLength - 1;
+        slots[0] = h0;
+        slots[1] = (h0 + segmentLength) ^ (static_cast<uint32_t>(hash >> 18u) & mask);
+        slots[2] = (h0 + 2 * segmentLength) ^ (static_cast<uint32_t>(hash) & mask);
+    }
+
+    uint8_t filterFingerprint(uint64_t hash) {
+        return static_cast<uint8_t>(hash ^ (hash >> 32u));
+    }
+
+    // calls f(begin, end) on each of 'threads' roughly equal parts of [0, count), all but
+    // one of them on new threads
+    template<typename Function>
+    void parallelFor(std::size_t count, unsigned int threads, Function f) {
+        if(threads <= 1 || count <= 1) {
+            f(std::size_t(0), count);
+            return;
+        }
+        std::size_t step = (count + threads - 1) / threads;
+        std::vector<std::thread> workers;
+        for(std::size_t begin = step; begin < count; begin += step)
+            workers.emplace_back(f, begin, std::min(begin + step, count));
+        f(std::size_t(0), step);
+        for(auto & worker : workers)
+            worker.join();
+    }
+
+    // sorts the keys and removes duplicates. Parts are sorted on separate threads, then
+    // merged pairwise, also in parallel.
+    void sortUnique(std::vector<uint64_t> & keys, unsigned int threads) {
+        std::size_t parts = keys.size() < FILTER_PARALLEL_MIN_KEYS ? 1 : threads;
+        std::vector<std::size_t> bounds(parts + 1);
+        for(std::size_t i = 0; i <= parts; ++i)
+            bounds[i] = keys.size() / parts * i + std::min(i, keys.size() % parts);
+
+        parallelFor(parts, static_cast<unsigned int>(parts), [&](std::size_t begin, std::size_t end) {
+            for(std::size_t i = begin; i < end; ++i)
+                std::sort(keys.begin() + static_cast<std::ptrdiff_t>(bounds[i]),
+                          keys.begin() + static_cast<std::ptrdiff_t>(bounds[i + 1]));
+        });
+
+        for(std::size_t width = 1; width < parts; width *= 2) {
+            std::size_t merges = (parts + 2 * width - 1) / (2 * width);
+            parallelFor(merges, static_cast<unsigned int>(merges), [&](std::size_t begin, std::size_t end) {
+                for(std::size_t m = begin; m < end; ++m) {
+                    std::size_t lo = 2 * width * m;
+                    std::size_t mid = std::min(lo + width, parts);
+                    std::size_t hi = std::min(lo + 2 * width, parts);
+                    if(mid < hi)
+                        std::inplace_merge(keys.begin() + static_cast<std::ptrdiff_t>(bounds[lo]),
+                                           keys.begin() + static_cast<std::ptrdiff_t>(bounds[mid]),
+                                           keys.begin() + static_cast<std::ptrdiff_t>(bounds[hi]));
+                }
+            });
+        }
+
+        keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+    }
+
+    struct FilterLayout {
+        uint32_t segmentLength;
+        uint32_t segmentCount;    // segments a key's first slot can be in
+        uint32_t arrayLength;     // (segmentCount + 2) * segmentLength slots
+    };
+
+    // sizes from the paper: larger filters use longer segments and less slack
+    FilterLayout filterLayout(std::size_t keyCount) {
+        auto n = static_cast<double>(keyCount);
+        FilterLayout layout{};
+        layout.segmentLength = std::min(FILTER_MAX_SEGMENT_LENGTH,
+                                        uint32_t(1) << static_cast<unsigned int>(std::floor(std::log(n) / std::log(3.33) + 2.25)));
+        double sizeFactor = keyCount <= 1 ? 0.0 : std::max(1.125, 0.875 + 0.25 * std::log(1000000.0) / std::log(n));
+        auto capacity = static_cast<uint64_t>(std::llround(n * sizeFactor));
+        uint64_t segmentCount = (capacity + layout.segmentLength - 1) / layout.segmentLength;
+        segmentCount = segmentCount > 3 ? segmentCount - 2 : 1;
+        uint64_t arrayLength = (segmentCount + 2) * layout.segmentLength;
+        if(arrayLength > UINT32_MAX)
+            throw std::runtime_error("too many keys for a filter");
+        layout.segmentCount = static_cast<uint32_t>(segmentCount);
+        layout.arrayLength = static_cast<uint32_t>(arrayLength);
+        return layout;
+    }
+
+    // one attempt at building the fingerprints of a binary fuse filter with the given seed.
+    // Returns false if the keys could not all be peeled (unlucky seed or duplicate keys).
+    bool buildFingerprints(
+            const std::vector<uint64_t> & keys,
+            uint64_t seed,
+            const FilterLayout & layout,
+            unsigned int threads,
+            std::vector<unsigned char> & fingerprints) {
+
+        const std::size_t n = keys.size();
+        const uint32_t segmentLength = layout.segmentLength;
+        const uint32_t segmentCount = layout.segmentCount;
+
+        // bucket the hashes by the segment of their first slot: thread t takes the t-th slice
+        // of the keys and counts how many of its hashes fall into each segment, then scatters
+        // them to their place in segment order
+        std::vector<std::size_t> offsets(static_cast<std::size_t>(threads) * segmentCount, 0);
+        auto slice = [&](std::size_t t, std::size_t & begin, std::size_t & end) {
+            begin = n / threads * t + std::min<std::size_t>(t, n % threads);
+            end = n / threads * (t + 1) + std::min<std::size_t>(t + 1, n % threads);
+        };
+        parallelFor(threads, threads, [&](std::size_t first, std::size_t last) {
+            uint32_t slots[3];
+            for(std::size_t t = first; t < last; ++t) {
+                std::size_t begin, end;
+                slice(t, begin, end);
+                std::size_t * histogram = &offsets[t * segmentCount];
+                for(std::size_t i = begin; i < end; ++i) {
+                    filterSlots(mix64(keys[i] + seed), segmentLength, segmentCount, slots);
+                    ++histogram[slots[0] / segmentLength];
+                }
+            }
+        });
+
+        std::vector<std::size_t> segmentBegin(segmentCount + 1);
+        std::size_t total = 0;
+        for(uint32_t segment = 0; segment < segmentCount; ++segment) {
+            segmentBegin[segment] = total;
+            for(std::size_t t = 0; t < threads; ++t) {
+                std::size_t count = offsets[t * segmentCount + segment];
+                offsets[t * segmentCount + segment] = total;
+                total += count;
+            }
+        }
+        segmentBegin[segmentCount] = total;
+
+        std::vector<uint64_t> hashes(n);
+        parallelFor(threads, threads, [&](std::size_t first, std::size_t last) {
+            uint32_t slots[3];
+            for(std::size_t t = first; t < last; ++t) {
+                std::size_t begin, end;
+                slice(t, begin, end);
+                std::size_t * next = &offsets[t * segmentCount];
+                for(std::size_t i = begin; i < end; ++i) {
+                    uint64_t hash = mix64(keys[i] + seed);
+                    filterSlots(hash, segmentLength, segmentCount, slots);
+                    hashes[next[slots[0] / segmentLength]++] = hash;
+                }
+            }
+        });
+
+        // for each slot: how many keys hash to it, and the xor of their hashes. The hashes of
+        // a group of segments only touch that group and the next two segments, so groups of
+        // at least two segments that are two groups apart never share a slot. All even groups
+        // are filled in at once, then all odd ones.
+        std::vector<uint8_t> counts(layout.arrayLength, 0);
+        std::vector<uint64_t> xors(layout.arrayLength, 0);
+        std::size_t groupSize = std::max<std::size_t>(2, (segmentCount + 2 * threads - 1) / (2 * threads));
+        std::size_t groups = (segmentCount + groupSize - 1) / groupSize;
+        std::atomic<bool> overflow(false);
+        for(std::size_t parity = 0; parity < 2; ++parity) {
+            std::size_t groupsOfParity = (groups + 1 - parity) / 2;
+            parallelFor(groupsOfParity, threads, [&](std::size_t first, std::size_t last) {
+                uint32_t slots[3];
+                for(std::size_t g = 2 * first + parity; g < 2 * last + parity; g += 2) {
+                    std::size_t begin = segmentBegin[g * groupSize];
+                    std::size_t end = segmentBegin[std::min<std::size_t>((g + 1) * groupSize, segmentCount)];
+                    for(std::size_t i = begin; i < end; ++i) {
+                        filterSlots(hashes[i], segmentLength, segmentCount, slots);
+                        for(uint32_t slot : slots) {
+                            if(++counts[slot] == 0)
+                                overflow = true; // only possible with many duplicate keys
+                            xors[slot] ^= hashes[i];
+                        }
+                    }
+                }
+            });
+        }
+        if(overflow)
+            return false;
+
+        // peel: repeatedly take a slot only one key hashes to, and remove that key from its
+        // other two slots. The hashes aren't needed in segment order any more, so the peeling
+        // order is recorded in their place.
+        std::vector<uint8_t> ownSlots(n);
+        std::vector<uint32_t> stack;
+        for(uint32_t i = 0; i < layout.arrayLength; ++i)
+            if(counts[i] == 1)
+                stack.push_back(i);
+
+        std::size_t peeled = 0;
+        while(!stack.empty()) {
+            uint32_t slot = stack.back();
+            stack.pop_back();
+            if(counts[slot] != 1)
+                continue;
+
+            uint64_t hash = xors[slot];
+            uint32_t slots[3];
+            filterSlots(hash, segmentLength, segmentCount, slots);
+            for(uint8_t j = 0; j < 3; ++j) {
+                if(slots[j] == slot) {
+                    hashes[peeled] = hash;
+                    ownSlots[peeled] = j;
+                    ++peeled;
+                }
+                xors[slots[j]] ^= hash;
+                if(--counts[slots[j]] == 1)
+                    stack.push_back(slots[j]);
+            }
+        }
+        if(peeled != n)
+            return false;
+
+        // assign fingerprints in the reverse order, so each key's own slot is set last
+        fingerprints.assign(layout.arrayLength, 0);
+        for(std::size_t i = n; i-- > 0;) {
+            uint32_t slots[3];
+            filterSlots(hashes[i], segmentLength, segmentCount, slots);
+            uint8_t own = ownSlots[i];
+            fingerprints[slots[own]] = static_cast<unsigned char>(
+                    filterFingerprint(hashes[i]) ^ fingerprints[slots[(own + 1) % 3]] ^ fingerprints[slots[(own + 2) % 3]]);
+        }
+        return true;
+    }
+
+    // the non-extended magic code of the network an (extended) magic code belongs to.
+    // Unknown magic codes are their own network.
+    int baseMagicCode(int magicCode) {
+        switch(magicCode) {
+            case txref::MAGIC_CODE_MAIN_EXTENDED:
+                return txref::MAGIC_CODE_MAIN;
+            case txref::MAGIC_CODE_TEST_EXTENDED:
+                return txref::MAGIC_CODE_TEST;
+            case txref::MAGIC_CODE_REGTEST_EXTENDED:
+                return txref::MAGIC_CODE_REGTEST;
+            default:
+                return magicCode;
+        }
+    }
+
+    // the number of bits needed to write value, ex: 0 for 0, 3 for 4-7
+    int bitLength(uint32_t value) {
+        int bits = 0;
+        for(; value != 0; value >>= 1u)
+            ++bits;
+        return bits;
+    }
+
+    // DistinctCounter parameters. A sketch has 2^12 one-byte registers, for about
+    // 1.04/sqrt(4096) = 1.6% standard error. Until then, hashes are kept exactly in a table
+    // that starts at 8 slots and doubles when it is 3/4 full, up to 512 slots: the same
+    // 4 KB as the sketch. Small counters so use memory in proportion to their count.
+    const int DISTINCT_PRECISION = 12;
+    const std::size_t DISTINCT_REGISTERS = std::size_t(1) << DISTINCT_PRECISION;
+    const std::size_t DISTINCT_TABLE_MIN_SIZE = 8;
+    const std::size_t DISTINCT_TABLE_MAX_SIZE = DISTINCT_REGISTERS / sizeof(uint64_t);
+    const std::size_t DISTINCT_EXACT_LIMIT = DISTINCT_TABLE_MAX_SIZE / 4 * 3;
+
+    // the hash that DistinctCounter counts for a packed key. The offset keeps key 0 (the
+    // genesis coinbase) away from hash 0, which marks an empty table slot.
+    uint64_t distinctHash(uint64_t key) {
+        uint64_t hash = mix64(key + 0x9e3779b97f4a7c15ULL);
+        return hash != 0 ? hash : 1;
+    }
+
+#ifdef TXREF_USE_POSIX
+    // O_DIRECT needs buffers, offsets and sizes aligned to the logical block size, which
+    // is at most this on common devices
+    const std::size_t DIRECT_IO_ALIGNMENT = 4096;
+
+    // the line in [begin, end), less a trailing '\r', decoded like TxFilter::inputKey()
+    // decodes a txref
+    void decodeLine(const char * begin, const char * end, txref::DecodedLine & line) {
+        if(end > begin && end[-1] == '\r')
+            --end;
+        line.coordinates = txref::Coordinates();
+        line.valid = txref::decodeTo(begin, static_cast<std::size_t>(end - begin), line.coordinates);
+    }
+
+    // memory for reads, aligned for O_DIRECT
+    struct AlignedFree {
+        void operator()(unsigned char * p) const { ::free(p); }
+    };
+    typedef std::unique_ptr<unsigned char, AlignedFree> AlignedBuffer;
+
+    AlignedBuffer allocateAligned(std::size_t size) {
+        void * p = nullptr;
+        if(::posix_memalign(&p, DIRECT_IO_ALIGNMENT, size) != 0)
+            throw std::bad_alloc();
+        return AlignedBuffer(static_cast<unsigned char *>(p));
+    }
+
+#ifdef TXREF_TESTING
+    // when not 0, reads report at most this many bytes, so the tests can force short reads
+    std::size_t testReadLimit = 0;
+#endif
+
+    // the number of bytes a read got, as the rest of decodeFile() sees it
+    std::size_t readResult(std::size_t length) {
+#ifdef TXREF_TESTING
+        if(testReadLimit != 0)
+            return std::min(length, testReadLimit);
+#endif
+        return length;
+    }
+
+    // reads up to size bytes at offset, stopping early at the end of the file, or after a
+    // short read that doesn't end at a multiple of alignment: O_DIRECT can't go on from there
+    std::size_t preadFully(int fd, unsigned char * buffer, std::size_t size, uint64_t offset,
+                           std::size_t alignment = 1) {
+        std::size_t done = 0;
+        while(done < size && done % alignment == 0) {
+            ssize_t n = ::pread(fd, buffer + done, size - done, static_cast<off_t>(offset + done));
+            if(n < 0 && errno == EINTR)
+                continue;
+            if(n < 0)
+                throw std::runtime_error(std::string("read failed: ") + std::strerror(errno));
+            if(n == 0)
+                break;
+            done += readResult(static_cast<std::size_t>(n));
+        }
+        return done;
+    }
+#endif
+
+#ifdef TXREF_USE_IO_URING
+    // a minimal io_uring for reads, using the system calls directly so there is no
+    // dependency on liburing. See io_uring_setup(2) and io_uring_enter(2).
+    class ReadRing {
+    public:
+        ReadRing() = default;
+        ReadRing(const ReadRing &) = delete;
+        ReadRing & operator=(const ReadRing &) = delete;
+
+        ~ReadRing() {
+            if(sqes_ != nullptr)
+                ::munmap(sqes_, sqesSize_);
+            if(cqRing_ != nullptr && cqRing_ != sqRing_)
+                ::munmap(cqRing_, cqRingSize_);
+            if(sqRing_ != nullptr)
+                ::munmap(sqRing_, sqRingSize_);
+            if(fd_ >= 0)
+                ::close(fd_);
+        }
+
+        // false if io_uring is not available, ex: an old kernel, or disabled by policy
+        bool open(unsigned int entries) {
+            io_uring_params params {};
+            fd_ = static_cast<int>(::syscall(__NR_io_uring_setup, entries, &params));
+            if(fd_ < 0)
+                return false;
+
+            sqRingSize_ = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+            cqRingSize_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+            bool singleMap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+            if(singleMap)
+                sqRingSize_ = cqRingSize_ = std::max(sqRingSize_, cqRingSize_);
+            sqRing_ = map(sqRingSize_, IORING_OFF_SQ_RING);
+            if(sqRing_ == nullptr)
+                return false;
+            cqRing_ = singleMap ? sqRing_ : map(cqRingSize_, IORING_OFF_CQ_RING);
+            sqesSize_ = params.sq_entries * sizeof(io_uring_sqe);
+            sqes_ = static_cast<io_uring_sqe *>(map(sqesSize_, IORING_OFF_SQES));
+            if(cqRing_ == nullptr || sqes_ == nullptr)
+                return false;
+
+            auto sq = static_cast<unsigned char *>(sqRing_);
+            auto cq = static_cast<unsigned char *>(cqRing_);
+            sqTail_ = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+            sqMask_ = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+            sqArray_ = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+            cqHead_ = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+            cqTail_ = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+            cqMask_ = *reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+            cqes_ = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+            return true;
+        }
+
+        // lets reads go straight into the buffers, without the kernel mapping them each time.
+        // Can fail, ex: over RLIMIT_MEMLOCK; reads then use readv instead.
+        bool registerBuffers(const iovec * buffers, unsigned int count) {
+            return ::syscall(__NR_io_uring_register, fd_, IORING_REGISTER_BUFFERS, buffers, count) == 0;
+        }
+
+        // queues a read into registered buffer bufferIndex (if registered) or into iov. The
+        // iovec must stay valid until the read completes.
+        void queueRead(int fd, const iovec * iov, int bufferIndex, uint64_t offset, uint64_t userData) {
+            unsigned tail = *sqTail_;
+            unsigned index = tail & sqMask_;
+            io_uring_sqe & sqe = sqes_[index];
+            std::memset(&sqe, 0, sizeof(sqe));
+            sqe.fd = fd;
+            sqe.off = offset;
+            sqe.user_data = userData;
+            if(bufferIndex >= 0) {
+                sqe.opcode = IORING_OP_READ_FIXED;
+                sqe.addr = reinterpret_cast<uint64_t>(iov->iov_base);
+                sqe.len = static_cast<uint32_t>(iov->iov_len);
+                sqe.buf_index = static_cast<uint16_t>(bufferIndex);
+            }
+            else {
+                sqe.opcode = IORING_OP_READV;
+                sqe.addr = reinterpret_cast<uint64_t>(iov);
+                sqe.len = 1;
+            }
+            sqArray_[index] = index;
+            __atomic_store_n(sqTail_, tail + 1, __ATOMIC_RELEASE);
+            ++queued_;
+        }
+
+        // submits the queued reads, and waits for at least minComplete completions
+        void submit(unsigned int minComplete) {
+            for(;;) {
+                long n = ::syscall(__NR_io_uring_enter, fd_, queued_, minComplete,
+                                   minComplete > 0 ? IORING_ENTER_GETEVENTS : 0u, nullptr, 0);
+                if(n >= 0) {
+                    queued_ -= static_cast<unsigned int>(n);
+                    if(queued_ == 0 || minComplete > 0)
+                        return;
+                }
+                else if(errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+                    throw std::runtime_error(std::string("io_uring_enter failed: ") + std::strerror(errno));
+                }
+            }
+        }
+
+        bool nextCompletion(uint64_t & userData, int & result) {
+            unsigned head = *cqHead_;
+            if(head == __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE))
+                return false;
+            const io_uring_cqe & cqe = cqes_[head & cqMask_];
+            userData = cqe.user_data;
+            result = cqe.res;
+            __atomic_store_n(cqHead_, head + 1, __ATOMIC_RELEASE);
+            return true;
+        }
+
+    private:
+        void * map(std::size_t size, off_t offset) {
+            void * p = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, offset);
+            return p == MAP_FAILED ? nullptr : p;
+        }
+
+        int fd_ = -1;
+        void * sqRing_ = nullptr;
+        void * cqRing_ = nullptr;
+        io_uring_sqe * sqes_ = nullptr;
+        std::size_t sqRingSize_ = 0;
+        std::size_t cqRingSize_ = 0;
+        std::size_t sqesSize_ = 0;
+        unsigned * sqTail_ = nullptr;
+        unsigned sqMask_ = 0;
+        unsigned * sqArray_ = nullptr;
+        unsigned * cqHead_ = nullptr;
+        unsigned * cqTail_ = nullptr;
+        unsigned cqMask_ = 0;
+        io_uring_cqe * cqes_ = nullptr;
+        unsigned int queued_ = 0;
+    };
+#endif
+
 }
 
 namespace txref {
@@ -434,6 +1659,10 @@ namespace txref {
 
     DecodedResult decode(const std::string & txref) {
 
+        // reject oversized input before doing any copying or full passes over it
+        if(!isWithinInputBounds(txref.data(), txref.length()))
+            throw std::runtime_error("input is too long to be a txref");
+
         std::string runningCommentary;
         std::string txrefClean = bech32::stripUnknownChars(txref);
         if(cleanTxrefContainsMixedcaseCharacters(txrefClean)) {
@@ -488,13 +1717,135 @@ namespace txref {
         return result;
     }
 
+    std::size_t encodeTo(
+            char * out,
+            std::size_t outlen,
+            const Coordinates & coordinates,
+            Style style,
+            bool uppercase) {
+
+        if(out == nullptr)
+            throw std::runtime_error("output buffer is null");
+
+        unsigned char dp[DATA_EXTENDED_SIZE + CHECKSUM_SIZE];
+        std::size_t dataSize = packDataPart(dp, coordinates);
+
+        const char * hrp = hrpForMagicCode(coordinates.magicCode);
+        std::size_t hrplen = std::char_traits<char>::length(hrp);
+
+        dataSize = appendChecksum(dp, dataSize, hrp, hrplen);
+
+        return writeTxref(out, outlen, hrp, hrplen, dp, dataSize, style, uppercase);
+    }
+
+    bool decodeTo(const char * txref, std::size_t length, Coordinates & coordinates) {
+        // parseTxref() also rejects oversized input without scanning it
+        ParsedTxref parsed;
+        if(txref == nullptr || !parseTxref(txref, length, parsed))
+            return false;
+        coordinates = unpackDataPart(parsed.dp, parsed.dataSize);
+        return true;
+    }
+
+    std::ostream & compact(std::ostream & os) {
+        os.iword(styleIndex()) = static_cast<long>(Style::compact);
+        return os;
+    }
+
+    std::ostream & pretty(std::ostream & os) {
+        os.iword(styleIndex()) = static_cast<long>(Style::pretty);
+        return os;
+    }
+
+    std::ostream & operator<<(std::ostream & os, const Coordinates & coordinates) {
+        std::ostream::sentry sentry(os);
+        if(!sentry)
+            return os;
+
+        auto style = static_cast<Style>(os.iword(styleIndex()));
+        bool uppercase = (os.flags() & std::ios_base::uppercase) != 0;
+
+        char buffer[TXREF_MAX_LENGTH];
+        std::size_t length = 0;
+        try {
+            length = encodeTo(buffer, sizeof(buffer), coordinates, style, uppercase);
+        }
+        catch(const std::runtime_error &) {
+            // out-of-range coordinates, like a number that doesn't parse
+            os.width(0);
+            os.setstate(std::ios_base::failbit);
+            return os;
+        }
+
+        // pad to the field width like a formatted string insertion, right-aligned unless
+        // std::left is set
+        auto text = static_cast<std::streamsize>(length);
+        std::streamsize padding = os.width() > text ? os.width() - text : 0;
+        bool left = (os.flags() & std::ios_base::adjustfield) == std::ios_base::left;
+        bool ok = true;
+        for(std::streamsize i = 0; !left && ok && i < padding; ++i)
+            ok = !std::ostream::traits_type::eq_int_type(os.rdbuf()->sputc(os.fill()), std::ostream::traits_type::eof());
+        ok = ok && os.rdbuf()->sputn(buffer, text) == text;
+        for(std::streamsize i = 0; left && ok && i < padding; ++i)
+            ok = !std::ostream::traits_type::eq_int_type(os.rdbuf()->sputc(os.fill()), std::ostream::traits_type::eof());
+        os.width(0);
+        if(!ok)
+            os.setstate(std::ios_base::badbit);
+        return os;
+    }
+
+    std::string encodeCompact(
+            int blockHeight,
+            int transactionIndex,
+            int txoIndex,
+            bool forceExtended,
+            const std::string & hrp) {
+
+        if(hrp.length() > bech32::limits::MAX_HRP_LENGTH)
+            throw std::runtime_error("HRP must be less than 84 characters long");
+
+        int magicCode = (txoIndex == 0 && !forceExtended) ? MAGIC_CODE_MAIN : MAGIC_CODE_MAIN_EXTENDED;
+
+        unsigned char dp[DATA_EXTENDED_SIZE + CHECKSUM_SIZE];
+        std::size_t dataSize = packDataPart(dp, Coordinates(blockHeight, transactionIndex, txoIndex, magicCode));
+        dataSize = appendChecksum(dp, dataSize, hrp.data(), hrp.length());
+
+        std::string result(txrefLength(hrp.length(), dataSize, Style::compact), '\0');
+        writeTxref(&result[0], result.length(), hrp.data(), hrp.length(), dp, dataSize, Style::compact, false);
+        return result;
+    }
+
+    std::string normalize(const std::string & txref) {
+        std::string result;
+        if(!normalizeInto(txref, result))
+            throw std::runtime_error("input is not a valid txref");
+        return result;
+    }
+
+    std::vector<std::string> normalize(const std::vector<std::string> & txrefs) {
+        std::vector<std::string> results(txrefs.size());
+        for(std::size_t i = 0; i < txrefs.size(); ++i)
+            normalizeInto(txrefs[i], results[i]);
+        return results;
+    }
+
+    bool parseTxid(const std::string & str, unsigned char * txid) {
+        if(str.length() != static_cast<std::string::size_type>(TXID_LENGTH))
+            return false;
+        return parseTxidHex(str.data(), txid);
+    }
+
     InputParam classifyInputString(const std::string & str) {
+        return classifyInputString(str, nullptr);
+    }
+
+    InputParam classifyInputString(const std::string & str, unsigned char * txid) {
 
         if(str.empty())
             return InputParam::unknown;
 
-        // if exactly 64 chars in length, it is likely a transaction id
-        if(str.length() == 64)
+        // if exactly 64 hex chars, it is a transaction id
+        if(str.length() == static_cast<std::string::size_type>(TXID_LENGTH) && parseTxidHex(str.data(), txid))
             return InputParam::txid;
 
         // if it starts with certain chars, and is of a certain length, it may be a bitcoin address
@@ -502,11 +1853,19 @@ namespace txref {
             if(str.length() >= 26 && str.length() < 36)
                 return InputParam::address;
 
+        // anything longer than this can't be any kind of txref
+        if(!isWithinInputBounds(str.data(), str.length()))
+            return InputParam::unknown;
+
+        // before testing for various txrefs, get rid of any unknown
+        // characters, ex: dashes, periods
+        std::string s = bech32::stripUnknownChars(str);
+
         // check if it could be a standard txref or txrefext
-        InputParam baseResult = classifyInputStringBase(str);
+        InputParam baseResult = classifyInputStringBase(s);
 
         // check if it could be a truncated txref or txrefext (missing the HRP)
-        InputParam missingResult = classifyInputStringMissingHRP(str);
+        InputParam missingResult = classifyInputStringMissingHRP(s);
 
         // if one result is 'unknown' and the other isn't, then return the good one
         if(baseResult != InputParam::unknown && missingResult == InputParam::unknown)
@@ -530,6 +1889,1116 @@ namespace txref {
         return baseResult;
     }
 
+    std::vector<InputParam> classifyInputStrings(
+            const std::vector<std::string> & strs,
+            std::vector<unsigned char> * txids) {
+
+        std::vector<InputParam> results(strs.size());
+        if(txids != nullptr)
+            txids->assign(strs.size() * TXID_SIZE, 0);
+
+        for(std::size_t i = 0; i < strs.size(); ++i) {
+            unsigned char * txid = txids != nullptr ? txids->data() + i * TXID_SIZE : nullptr;
+            results[i] = classifyInputString(strs[i], txid);
+        }
+        return results;
+    }
+
+    std::uint64_t TxFilter::txidKey(const unsigned char * txid) {
+        uint64_t key = 0;
+        for(int i = 0; i < TXID_SIZE; i += 8)
+            key = mix64(key ^ loadLittleEndian(txid + i, 8));
+        return key;
+    }
+
+    std::uint64_t TxFilter::coordinatesKey(const Coordinates & coordinates) {
+        checkBlockHeightRange(coordinates.blockHeight);
+        checkTransactionIndexRange(coordinates.transactionIndex);
+        checkTxoIndexRange(coordinates.txoIndex);
+        checkMagicCodeRange(coordinates.magicCode);
+
+        return static_cast<uint64_t>(coordinates.magicCode) << 54u |
+               static_cast<uint64_t>(coordinates.blockHeight) << 30u |
+               static_cast<uint64_t>(coordinates.transactionIndex) << 15u |
+               static_cast<uint64_t>(coordinates.txoIndex);
+    }
+
+    TxFilter TxFilter::build(std::vector<std::uint64_t> keys, unsigned int threads) {
+        if(threads == 0)
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        if(keys.size() < FILTER_PARALLEL_MIN_KEYS)
+            threads = 1;
+
+        TxFilter filter;
+        if(keys.empty())
+            return filter;
+
+        bool deduplicated = false;
+        uint64_t seed = FILTER_FIRST_SEED;
+        for(int attempt = 0; attempt < FILTER_MAX_ATTEMPTS; ++attempt) {
+            FilterLayout layout = filterLayout(keys.size());
+            if(buildFingerprints(keys, seed, layout, threads, filter.storage_)) {
+                filter.seed_ = seed;
+                filter.keyCount_ = keys.size();
+                filter.segmentLength_ = layout.segmentLength;
+                filter.segmentCount_ = layout.segmentCount;
+                filter.arrayLength_ = layout.arrayLength;
+                return filter;
+            }
+
+            // duplicate keys can never be peeled. Only look for them once something failed, and
+            // if there were any, start over with the same seeds so the filter only depends on
+            // the set of keys.
+            if(!deduplicated) {
+                deduplicated = true;
+                std::size_t count = keys.size();
+                sortUnique(keys, threads);
+                if(keys.size() != count) {
+                    seed = FILTER_FIRST_SEED;
+                    continue;
+                }
+            }
+            seed = mix64(seed);
+        }
+        throw std::runtime_error("could not build the filter");
+    }
+
+    TxFilter TxFilter::view(const unsigned char * data, std::size_t size) {
+        if(data == nullptr || size < FILTER_HEADER_SIZE || !std::equal(FILTER_MAGIC, FILTER_MAGIC + 8, data))
+            throw std::runtime_error("data is not a txref filter");
+
+        TxFilter filter;
+        filter.seed_ = loadLittleEndian(data + 8, 8);
+        filter.keyCount_ = loadLittleEndian(data + 16, 8);
+        filter.segmentLength_ = static_cast<uint32_t>(loadLittleEndian(data + 24, 4));
+        filter.segmentCount_ = static_cast<uint32_t>(loadLittleEndian(data + 28, 4));
+        filter.arrayLength_ = static_cast<uint32_t>(loadLittleEndian(data + 32, 4));
+
+        uint32_t segmentLength = filter.segmentLength_;
+        bool empty = filter.arrayLength_ == 0 && filter.segmentCount_ == 0 && segmentLength == 0;
+        bool validSegments = segmentLength > 0 && segmentLength <= FILTER_MAX_SEGMENT_LENGTH &&
+                             (segmentLength & (segmentLength - 1)) == 0 && filter.segmentCount_ > 0 &&
+                             (static_cast<uint64_t>(filter.segmentCount_) + 2) * segmentLength == filter.arrayLength_;
+        if((!empty && !validSegments) || size - FILTER_HEADER_SIZE != filter.arrayLength_)
+            throw std::runtime_error("txref filter is corrupt or truncated");
+
+        filter.external_ = data + FILTER_HEADER_SIZE;
+        return filter;
+    }
+
+    std::vector<unsigned char> TxFilter::serialize() const {
+        std::vector<unsigned char> out(FILTER_HEADER_SIZE + arrayLength_, 0);
+        std::copy(FILTER_MAGIC, FILTER_MAGIC + 8, out.begin());
+        storeLittleEndian(&out[8], seed_, 8);
+        storeLittleEndian(&out[16], keyCount_, 8);
+        storeLittleEndian(&out[24], segmentLength_, 4);
+        storeLittleEndian(&out[28], segmentCount_, 4);
+        storeLittleEndian(&out[32], arrayLength_, 4);
+        if(arrayLength_ > 0)
+            std::copy(fingerprints(), fingerprints() + arrayLength_, out.begin() + FILTER_HEADER_SIZE);
+        return out;
+    }
+
+    bool TxFilter::mayContain(std::uint64_t key) const {
+        if(arrayLength_ == 0)
+            return false;
+        uint64_t hash = mix64(key + seed_);
+        uint32_t slots[3];
+        filterSlots(hash, segmentLength_, segmentCount_, slots);
+        const unsigned char * f = fingerprints();
+        return static_cast<uint8_t>(f[slots[0]] ^ f[slots[1]] ^ f[slots[2]]) == filterFingerprint(hash);
+    }
+
+    bool TxFilter::mayContainTxid(const unsigned char * txid) const {
+        return mayContain(txidKey(txid));
+    }
+
+    bool TxFilter::mayContain(const Coordinates & coordinates) const {
+        return mayContain(coordinatesKey(coordinates));
+    }
+
+    bool TxFilter::inputKey(const std::string & input, std::uint64_t & key) {
+        unsigned char txid[TXID_SIZE];
+        if(input.length() == static_cast<std::string::size_type>(TXID_LENGTH) && parseTxidHex(input.data(), txid)) {
+            key = txidKey(txid);
+            return true;
+        }
+
+        // parseTxref() also rejects oversized input without scanning it
+        ParsedTxref parsed;
+        if(!parseTxref(input.data(), input.length(), parsed))
+            return false;
+        key = coordinatesKey(unpackDataPart(parsed.dp, parsed.dataSize));
+        return true;
+    }
+
+    bool TxFilter::mayContain(const std::string & input) const {
+        std::uint64_t key;
+        return inputKey(input, key) && mayContain(key);
+    }
+
+    BlockSummary scanBlock(const unsigned char * block, std::size_t blockSize) {
+        if(block == nullptr)
+            throw std::runtime_error("block is null");
+
+        BlockReader reader{block, block + blockSize};
+        reader.skip(BLOCK_HEADER_SIZE);
+
+        BlockSummary summary;
+        summary.transactionCount = static_cast<std::size_t>(reader.readCount());
+        for(std::size_t i = 0; i < summary.transactionCount; ++i)
+            summary.outputCount += readTransaction(reader, nullptr);
+
+        if(reader.remaining() != 0)
+            throw std::runtime_error("serialized block has trailing data");
+        return summary;
+    }
+
+    std::size_t encodeBlock(
+            const unsigned char * block,
+            std::size_t blockSize,
+            int blockHeight,
+            BlockTransaction * transactions,
+            std::size_t maxTransactions,
+            char * outputs,
+            std::size_t maxOutputs,
+            int magicCode,
+            Style style) {
+
+        if(block == nullptr)
+            throw std::runtime_error("block is null");
+        if(transactions == nullptr && maxTransactions > 0)
+            throw std::runtime_error("transactions buffer is null");
+        int extendedMagicCode = extendedMagicCodeFor(magicCode);
+        checkBlockHeightRange(blockHeight);
+
+        BlockReader reader{block, block + blockSize};
+        reader.skip(BLOCK_HEADER_SIZE);
+
+        auto transactionCount = static_cast<std::size_t>(reader.readCount());
+        if(transactionCount > maxTransactions)
+            throw std::runtime_error("transactions buffer is too small for the block");
+
+        std::size_t outputIndex = 0;
+        for(std::size_t i = 0; i < transactionCount; ++i) {
+            if(i > static_cast<std::size_t>(MAX_TRANSACTION_INDEX))
+                throw std::runtime_error("transaction index is too large");
+
+            BlockTransaction & tx = transactions[i];
+            tx.outputCount = readTransaction(reader, tx.txid);
+            tx.firstOutput = outputIndex;
+            outputIndex += tx.outputCount;
+
+            auto transactionIndex = static_cast<int>(i);
+            encodeIntoSlot(tx.txref, Coordinates(blockHeight, transactionIndex, 0, magicCode), style);
+
+            if(outputs == nullptr)
+                continue;
+            if(outputIndex > maxOutputs)
+                throw std::runtime_error("outputs buffer is too small for the block");
+            if(tx.outputCount > static_cast<std::size_t>(MAX_TXO_INDEX) + 1)
+                throw std::runtime_error("txo index is too large");
+            for(std::size_t txo = 0; txo < tx.outputCount; ++txo) {
+                encodeIntoSlot(outputs + (tx.firstOutput + txo) * TXREF_BUFFER_SIZE,
+                               Coordinates(blockHeight, transactionIndex, static_cast<int>(txo), extendedMagicCode),
+                               style);
+            }
+        }
+
+        if(reader.remaining() != 0)
+            throw std::runtime_error("serialized block has trailing data");
+        return transactionCount;
+    }
+
+    BlockTimeIndex BlockTimeIndex::fromHeaders(const unsigned char * headers, std::size_t count, int magicCode) {
+        if(headers == nullptr && count > 0)
+            throw std::runtime_error("headers are null");
+
+        std::vector<uint32_t> times(count);
+        unsigned char hash[32] = {};
+        for(std::size_t i = 0; i < count; ++i) {
+            const unsigned char * header = headers + i * BLOCK_HEADER_SIZE;
+            if(!std::equal(hash, hash + sizeof(hash), header + HEADER_PREVIOUS_HASH_OFFSET))
+                throw std::runtime_error("headers do not form a chain from the genesis block at height " +
+                                         std::to_string(i));
+            blockHash(header, hash);
+            times[i] = static_cast<uint32_t>(loadLittleEndian(header + HEADER_TIME_OFFSET, 4));
+        }
+        return fromTimes(times, magicCode);
+    }
+
+    BlockTimeIndex BlockTimeIndex::fromUnorderedHeaders(const unsigned char * headers, std::size_t count, int magicCode) {
+        if(headers == nullptr && count > 0)
+            throw std::runtime_error("headers are null");
+
+        // sort the headers by hash, so each one's parent can be found with a binary search
+        std::vector<unsigned char> hashes(count * 32);
+        for(std::size_t i = 0; i < count; ++i)
+            blockHash(headers + i * BLOCK_HEADER_SIZE, &hashes[i * 32]);
+        std::vector<std::size_t> byHash(count);
+        for(std::size_t i = 0; i < count; ++i)
+            byHash[i] = i;
+        std::sort(byHash.begin(), byHash.end(), [&](std::size_t a, std::size_t b) {
+            return std::memcmp(&hashes[a * 32], &hashes[b * 32], 32) < 0;
+        });
+        // keep one copy of each header, so every lookup of a hash finds the same one
+        byHash.erase(std::unique(byHash.begin(), byHash.end(), [&](std::size_t a, std::size_t b) {
+            return std::memcmp(&hashes[a * 32], &hashes[b * 32], 32) == 0;
+        }), byHash.end());
+
+        const std::size_t none = count;
+        auto findByHash = [&](const unsigned char * hash) {
+            auto found = std::lower_bound(byHash.begin(), byHash.end(), hash,
+                                          [&](std::size_t a, const unsigned char * h) {
+                                              return std::memcmp(&hashes[a * 32], h, 32) < 0;
+                                          });
+            return found != byHash.end() && std::memcmp(&hashes[*found * 32], hash, 32) == 0 ? *found : none;
+        };
+
+        const unsigned char zeros[32] = {};
+        std::vector<std::size_t> parent(count, none);
+        std::size_t genesis = none;
+        for(std::size_t i = 0; i < count; ++i) {
+            const unsigned char * previous = headers + i * BLOCK_HEADER_SIZE + HEADER_PREVIOUS_HASH_OFFSET;
+            if(std::equal(zeros, zeros + 32, previous)) {
+                if(genesis == none)
+                    genesis = findByHash(&hashes[i * 32]);
+                continue;
+            }
+            parent[i] = findByHash(previous);
+        }
+        if(genesis == none)
+            throw std::runtime_error("headers do not include a genesis block");
+
+        // the height and total work of every header that connects to the genesis block,
+        // walking up to an already known ancestor and back down again
+        const int unknown = -1;
+        const int unconnected = -2;
+        std::vector<int> heights(count, unknown);
+        std::vector<double> work(count, 0.0);
+        heights[genesis] = 0;
+        work[genesis] = blockWork(static_cast<uint32_t>(loadLittleEndian(headers + genesis * BLOCK_HEADER_SIZE + HEADER_BITS_OFFSET, 4)));
+        std::vector<std::size_t> path;
+        for(std::size_t i = 0; i < count; ++i) {
+            std::size_t at = i;
+            while(heights[at] == unknown) {
+                path.push_back(at);
+                heights[at] = unconnected; // until proven otherwise, which also stops cycles
+                if(parent[at] == none)
+                    break;
+                at = parent[at];
+            }
+            bool connected = heights[at] >= 0;
+            while(!path.empty()) {
+                std::size_t child = path.back();
+                path.pop_back();
+                if(connected && heights[parent[child]] >= 0) {
+                    heights[child] = heights[parent[child]] + 1;
+                    auto bits = static_cast<uint32_t>(loadLittleEndian(headers + child * BLOCK_HEADER_SIZE + HEADER_BITS_OFFSET, 4));
+                    work[child] = work[parent[child]] + blockWork(bits);
+                }
+            }
+        }
+
+        std::size_t tip = genesis;
+        for(std::size_t i = 0; i < count; ++i)
+            if(heights[i] >= 0 && work[i] > work[tip])
+                tip = i;
+
+        std::vector<uint32_t> times(static_cast<std::size_t>(heights[tip]) + 1);
+        for(std::size_t at = tip; ; at = parent[at]) {
+            times[static_cast<std::size_t>(heights[at])] =
+                    static_cast<uint32_t>(loadLittleEndian(headers + at * BLOCK_HEADER_SIZE + HEADER_TIME_OFFSET, 4));
+            if(at == genesis)
+                break;
+        }
+        return fromTimes(times, magicCode);
+    }
+
+    BlockTimeIndex BlockTimeIndex::fromTimes(const std::vector<std::uint32_t> & times, int magicCode) {
+        extendedMagicCodeFor(magicCode); // throws unless magicCode is a non-extended one
+        if(times.size() > static_cast<std::size_t>(MAX_BLOCK_HEIGHT) + 1)
+            throw std::runtime_error("block height is too large");
+
+        BlockTimeIndex index;
+        index.count_ = static_cast<uint32_t>(times.size());
+        index.magicCode_ = magicCode;
+        index.storage_.assign(TIME_INDEX_HEADER_SIZE + TIME_INDEX_COLUMNS * 4 * times.size(), 0);
+
+        unsigned char * out = index.storage_.data();
+        std::copy(TIME_INDEX_MAGIC, TIME_INDEX_MAGIC + 8, out);
+        storeLittleEndian(out + 8, index.count_, 4);
+        storeLittleEndian(out + 12, static_cast<uint64_t>(magicCode), 4);
+
+        auto column = [&](int c, std::size_t height) {
+            return out + TIME_INDEX_HEADER_SIZE + (static_cast<std::size_t>(c) * times.size() + height) * 4;
+        };
+
+        uint32_t window[11];
+        uint32_t latest = 0;
+        uint32_t previousMedian = 0;
+        for(std::size_t h = 0; h < times.size(); ++h) {
+            std::size_t first = h >= 10 ? h - 10 : 0;
+            std::size_t n = h - first + 1;
+            for(std::size_t i = 0; i < n; ++i) { // insertion sort of at most 11 values
+                uint32_t t = times[first + i];
+                std::size_t j = i;
+                for(; j > 0 && window[j - 1] > t; --j)
+                    window[j] = window[j - 1];
+                window[j] = t;
+            }
+            latest = std::max(latest, times[h]);
+            // consensus requires a block time after the previous median-time-past, so in a
+            // valid chain it never decreases; heightRangeByMedianTime() depends on that
+            if(window[n / 2] < previousMedian)
+                throw std::runtime_error("block timestamps are not valid: median-time-past decreases at height " +
+                                         std::to_string(h));
+            previousMedian = window[n / 2];
+
+            storeLittleEndian(column(TIME_COLUMN, h), times[h], 4);
+            storeLittleEndian(column(MEDIAN_TIME_COLUMN, h), window[n / 2], 4);
+            storeLittleEndian(column(MAX_TIME_COLUMN, h), latest, 4);
+        }
+        uint32_t earliest = UINT32_MAX;
+        for(std::size_t h = times.size(); h-- > 0;) {
+            earliest = std::min(earliest, times[h]);
+            storeLittleEndian(column(MIN_TIME_COLUMN, h), earliest, 4);
+        }
+        return index;
+    }
+
+    BlockTimeIndex BlockTimeIndex::view(const unsigned char * data, std::size_t size) {
+        if(data == nullptr || size < TIME_INDEX_HEADER_SIZE ||
+           !std::equal(TIME_INDEX_MAGIC, TIME_INDEX_MAGIC + 8, data))
+            throw std::runtime_error("data is not a block time index");
+
+        BlockTimeIndex index;
+        index.count_ = static_cast<uint32_t>(loadLittleEndian(data + 8, 4));
+        index.magicCode_ = static_cast<int>(loadLittleEndian(data + 12, 4));
+        if(size - TIME_INDEX_HEADER_SIZE != static_cast<uint64_t>(TIME_INDEX_COLUMNS) * 4 * index.count_ ||
+           index.count_ > static_cast<uint32_t>(MAX_BLOCK_HEIGHT) + 1)
+            throw std::runtime_error("block time index is corrupt or truncated");
+        extendedMagicCodeFor(index.magicCode_);
+
+        index.external_ = data;
+        return index;
+    }
+
+    std::vector<unsigned char> BlockTimeIndex::serialize() const {
+        if(external_ == nullptr && storage_.empty())
+            return fromTimes(std::vector<uint32_t>(), magicCode_).storage_;
+        return std::vector<unsigned char>(data(), data() + TIME_INDEX_HEADER_SIZE + TIME_INDEX_COLUMNS * 4 * count_);
+    }
+
+    std::uint32_t BlockTimeIndex::value(int column, std::size_t blockHeight) const {
+        return static_cast<uint32_t>(loadLittleEndian(
+                data() + TIME_INDEX_HEADER_SIZE + (static_cast<std::size_t>(column) * count_ + blockHeight) * 4, 4));
+    }
+
+    std::uint32_t BlockTimeIndex::blockTime(int blockHeight) const {
+        if(blockHeight < 0 || static_cast<uint32_t>(blockHeight) >= count_)
+            throw std::runtime_error("block height is not in the index");
+        return value(TIME_COLUMN, static_cast<std::size_t>(blockHeight));
+    }
+
+    std::uint32_t BlockTimeIndex::medianTimePast(int blockHeight) const {
+        if(blockHeight < 0 || static_cast<uint32_t>(blockHeight) >= count_)
+            throw std::runtime_error("block height is not in the index");
+        return value(MEDIAN_TIME_COLUMN, static_cast<std::size_t>(blockHeight));
+    }
+
+    std::pair<int, int> BlockTimeIndex::heightRange(std::uint32_t begin, std::uint32_t end) const {
+        if(begin >= end)
+            return std::make_pair(0, 0);
+        // a block with a timestamp >= begin can't come before the first height where the
+        // latest timestamp so far reaches begin. Likewise for end, from the other side.
+        std::size_t first = lowerBound(count_, begin, [&](std::size_t h) { return value(MAX_TIME_COLUMN, h); });
+        std::size_t last = lowerBound(count_, end, [&](std::size_t h) { return value(MIN_TIME_COLUMN, h); });
+        return std::make_pair(static_cast<int>(first), static_cast<int>(std::max(first, last)));
+    }
+
+    std::pair<int, int> BlockTimeIndex::heightRangeByMedianTime(std::uint32_t begin, std::uint32_t end) const {
+        if(begin >= end)
+            return std::make_pair(0, 0);
+        std::size_t first = lowerBound(count_, begin, [&](std::size_t h) { return value(MEDIAN_TIME_COLUMN, h); });
+        std::size_t last = lowerBound(count_, end, [&](std::size_t h) { return value(MEDIAN_TIME_COLUMN, h); });
+        return std::make_pair(static_cast<int>(first), static_cast<int>(std::max(first, last)));
+    }
+
+    DecodedResult decode(const std::string & txref, const BlockTimeIndex & times) {
+        DecodedResult result = decode(txref);
+        bool sameNetwork = result.magicCode == times.magicCode() ||
+                           result.magicCode == extendedMagicCodeFor(times.magicCode());
+        if(sameNetwork && static_cast<std::size_t>(result.blockHeight) < times.size()) {
+            result.blockTime = times.blockTime(result.blockHeight);
+            result.medianTimePast = times.medianTimePast(result.blockHeight);
+        }
+        return result;
+    }
+
+    // a named namespace, since TxrefAggregator::State has external linkage
+    namespace detail {
+
+        // counts distinct hashes in at most 4 KB: exactly while there are few of them,
+        // then with a HyperLogLog sketch (Flajolet et al., "HyperLogLog: the analysis of a
+        // near-optimal cardinality estimation algorithm", 2007). Counters are mergeable.
+        class DistinctCounter {
+        public:
+            void add(uint64_t hash) {
+                if(!registers_.empty()) {
+                    addToSketch(hash);
+                    return;
+                }
+                if(table_.empty())
+                    table_.assign(DISTINCT_TABLE_MIN_SIZE, 0);
+                if(!insert(table_, hash))
+                    return;
+                if(++exactCount_ > DISTINCT_EXACT_LIMIT)
+                    toSketch();
+                else if(exactCount_ > table_.size() / 4 * 3)
+                    grow();
+            }
+
+            void merge(const DistinctCounter & other) {
+                if(other.registers_.empty()) {
+                    for(uint64_t hash : other.table_) {
+                        if(hash != 0)
+                            add(hash);
+                    }
+                    return;
+                }
+                if(registers_.empty())
+                    toSketch();
+                for(std::size_t i = 0; i < DISTINCT_REGISTERS; ++i)
+                    registers_[i] = std::max(registers_[i], other.registers_[i]);
+            }
+
+            uint64_t estimate() const {
+                if(registers_.empty())
+                    return exactCount_;
+
+                double sum = 0;
+                std::size_t zeros = 0;
+                for(uint8_t rank : registers_) {
+                    sum += std::ldexp(1.0, -rank);
+                    zeros += rank == 0 ? 1 : 0;
+                }
+                const auto m = static_cast<double>(DISTINCT_REGISTERS);
+                double estimate = 0.7213 / (1 + 1.079 / m) * m * m / sum;
+                // small cardinalities are estimated better from the empty registers. With 64-bit
+                // hashes no correction is needed for large ones.
+                if(estimate <= 2.5 * m && zeros > 0)
+                    estimate = m * std::log(m / static_cast<double>(zeros));
+                return static_cast<uint64_t>(estimate + 0.5);
+            }
+
+            // the memory held, not counting the counter itself
+            std::size_t bytes() const {
+                return table_.capacity() * sizeof(uint64_t) + registers_.capacity();
+            }
+
+        private:
+            // adds hash to an open-addressing table. Returns false if it was already there.
+            static bool insert(std::vector<uint64_t> & table, uint64_t hash) {
+                const std::size_t mask = table.size() - 1;
+                for(std::size_t i = hash & mask;; i = (i + 1) & mask) {
+                    if(table[i] == hash)
+                        return false;
+                    if(table[i] == 0) {
+                        table[i] = hash;
+                        return true;
+                    }
+                }
+            }
+
+            void grow() {
+                std::vector<uint64_t> larger(table_.size() * 2, 0);
+                for(uint64_t hash : table_) {
+                    if(hash != 0)
+                        insert(larger, hash);
+                }
+                table_.swap(larger);
+            }
+
+            void toSketch() {
+                registers_.assign(DISTINCT_REGISTERS, 0);
+                for(uint64_t hash : table_) {
+                    if(hash != 0)
+                        addToSketch(hash);
+                }
+                std::vector<uint64_t>().swap(table_);
+            }
+
+            // the top bits pick a register, which keeps the highest position of the first
+            // set bit seen among the remaining bits
+            void addToSketch(uint64_t hash) {
+                std::size_t index = static_cast<std::size_t>(hash >> (64u - DISTINCT_PRECISION));
+                uint64_t rest = hash << static_cast<unsigned int>(DISTINCT_PRECISION);
+                uint8_t rank = 1;
+                while(rank <= 64 - DISTINCT_PRECISION && (rest & 0x8000000000000000ULL) == 0) {
+                    rest <<= 1u;
+                    ++rank;
+                }
+                registers_[index] = std::max(registers_[index], rank);
+            }
+
+            std::vector<uint64_t> table_;      // exact hashes, 0 for an empty slot
+            uint64_t exactCount_ = 0;
+            std::vector<uint8_t> registers_;   // the sketch, once there are too many hashes
+        };
+
+    }
+
+    struct TxrefAggregator::State {
+        struct Group {
+            TxrefGroup totals;
+            detail::DistinctCounter transactions;
+            detail::DistinctCounter outputs;
+        };
+
+        explicit State(int bucketSize) : bucketSize(bucketSize) {}
+
+        // the group for a packed (bucket, network, extended) key, created if needed. Inputs
+        // are often sorted, so the last group found is checked first.
+        Group & group(int bucket, int network, bool extended) {
+            uint64_t key = static_cast<uint64_t>(bucket) << 6u | static_cast<uint64_t>(network) << 1u |
+                           (extended ? 1u : 0u);
+            if(key == lastKey)
+                return groups[lastGroup];
+
+            auto found = index.find(key);
+            if(found == index.end()) {
+                found = index.emplace(key, groups.size()).first;
+                groups.emplace_back();
+                TxrefGroup & totals = groups.back().totals;
+                totals.firstHeight = bucket * bucketSize;
+                totals.magicCode = network;
+                totals.extended = extended;
+                totals.minHeight = totals.minTransactionIndex = totals.minTxoIndex = std::numeric_limits<int>::max();
+                totals.maxHeight = totals.maxTransactionIndex = totals.maxTxoIndex = std::numeric_limits<int>::min();
+            }
+            lastKey = key;
+            lastGroup = found->second;
+            return groups[lastGroup];
+        }
+
+        void add(const Coordinates & coordinates, bool extended) {
+            Group & g = group(coordinates.blockHeight / bucketSize, baseMagicCode(coordinates.magicCode), extended);
+            TxrefGroup & totals = g.totals;
+            ++totals.count;
+            totals.minHeight = std::min(totals.minHeight, coordinates.blockHeight);
+            totals.maxHeight = std::max(totals.maxHeight, coordinates.blockHeight);
+            totals.minTransactionIndex = std::min(totals.minTransactionIndex, coordinates.transactionIndex);
+            totals.maxTransactionIndex = std::max(totals.maxTransactionIndex, coordinates.transactionIndex);
+            totals.minTxoIndex = std::min(totals.minTxoIndex, coordinates.txoIndex);
+            totals.maxTxoIndex = std::max(totals.maxTxoIndex, coordinates.txoIndex);
+
+            // the same packing as TxFilter::coordinatesKey(), less the magic code, which is
+            // the same for the whole group
+            uint64_t transaction = static_cast<uint64_t>(coordinates.blockHeight) << 15u |
+                                   static_cast<uint64_t>(coordinates.transactionIndex);
+            g.transactions.add(distinctHash(transaction));
+            if(extended) {
+                g.outputs.add(distinctHash(transaction << 15u | static_cast<uint64_t>(coordinates.txoIndex)));
+                ++totals.txoHistogram[bitLength(static_cast<uint32_t>(coordinates.txoIndex))];
+            }
+        }
+
+        int bucketSize;
+        uint64_t invalid = 0;
+        std::vector<Group> groups;
+        std::unordered_map<uint64_t, std::size_t> index;   // packed key -> position in groups
+        uint64_t lastKey = ~uint64_t(0);
+        std::size_t lastGroup = 0;
+    };
+
+    TxrefAggregator::TxrefAggregator(int bucketSize) {
+        if(bucketSize < 1)
+            throw std::runtime_error("bucket size must be at least 1");
+        state_.reset(new State(bucketSize));
+    }
+
+    TxrefAggregator::~TxrefAggregator() = default;
+    TxrefAggregator::TxrefAggregator(TxrefAggregator &&) noexcept = default;
+    TxrefAggregator & TxrefAggregator::operator=(TxrefAggregator &&) noexcept = default;
+
+    bool TxrefAggregator::add(const char * txref, std::size_t length) {
+        // parseTxref() also rejects oversized input without scanning it
+        ParsedTxref parsed;
+        if(txref == nullptr || !parseTxref(txref, length, parsed)) {
+            ++state_->invalid;
+            return false;
+        }
+        state_->add(unpackDataPart(parsed.dp, parsed.dataSize),
+                    parsed.dataSize == static_cast<std::size_t>(DATA_EXTENDED_SIZE));
+        return true;
+    }
+
+    bool TxrefAggregator::add(const std::string & txref) {
+        return add(txref.data(), txref.length());
+    }
+
+    void TxrefAggregator::add(const Coordinates & coordinates) {
+        checkBlockHeightRange(coordinates.blockHeight);
+        checkTransactionIndexRange(coordinates.transactionIndex);
+        checkTxoIndexRange(coordinates.txoIndex);
+        checkMagicCodeRange(coordinates.magicCode);
+        bool extended = isExtendedMagicCode(coordinates.magicCode);
+        if(!extended && coordinates.txoIndex != 0)
+            throw std::runtime_error("magic code does not support extended txrefs");
+        state_->add(coordinates, extended);
+    }
+
+    void TxrefAggregator::merge(const TxrefAggregator & other) {
+        if(other.state_->bucketSize != state_->bucketSize)
+            throw std::runtime_error("can't merge aggregators with different bucket sizes");
+
+        state_->invalid += other.state_->invalid;
+        for(const auto & theirs : other.state_->groups) {
+            const TxrefGroup & from = theirs.totals;
+            State::Group & ours = state_->group(from.firstHeight / state_->bucketSize, from.magicCode, from.extended);
+            TxrefGroup & to = ours.totals;
+            to.count += from.count;
+            to.minHeight = std::min(to.minHeight, from.minHeight);
+            to.maxHeight = std::max(to.maxHeight, from.maxHeight);
+            to.minTransactionIndex = std::min(to.minTransactionIndex, from.minTransactionIndex);
+            to.maxTransactionIndex = std::max(to.maxTransactionIndex, from.maxTransactionIndex);
+            to.minTxoIndex = std::min(to.minTxoIndex, from.minTxoIndex);
+            to.maxTxoIndex = std::max(to.maxTxoIndex, from.maxTxoIndex);
+            for(std::size_t i = 0; i < sizeof(to.txoHistogram) / sizeof(to.txoHistogram[0]); ++i)
+                to.txoHistogram[i] += from.txoHistogram[i];
+            ours.transactions.merge(theirs.transactions);
+            ours.outputs.merge(theirs.outputs);
+        }
+    }
+
+    std::vector<TxrefGroup> TxrefAggregator::groups() const {
+        std::vector<TxrefGroup> result;
+        result.reserve(state_->groups.size());
+        for(const auto & group : state_->groups) {
+            result.push_back(group.totals);
+            result.back().distinctTransactions = group.transactions.estimate();
+            result.back().distinctOutputs = group.outputs.estimate();
+        }
+        std::sort(result.begin(), result.end(), [](const TxrefGroup & a, const TxrefGroup & b) {
+            if(a.firstHeight != b.firstHeight)
+                return a.firstHeight < b.firstHeight;
+            if(a.magicCode != b.magicCode)
+                return a.magicCode < b.magicCode;
+            return a.extended < b.extended;
+        });
+        return result;
+    }
+
+    int TxrefAggregator::bucketSize() const {
+        return state_->bucketSize;
+    }
+
+    std::uint64_t TxrefAggregator::invalidCount() const {
+        return state_->invalid;
+    }
+
+    FileDecodeStats decodeFile(
+            const std::string & path,
+            const DecodedLinesHandler & handler,
+            const FileDecodeOptions & options) {
+#ifndef TXREF_USE_POSIX
+        (void)path;
+        (void)handler;
+        (void)options;
+        throw std::runtime_error("decodeFile() is only available on POSIX systems");
+#else
+        FileDecodeStats stats;
+        unsigned int threads = options.threads != 0 ? options.threads : std::max(1u, std::thread::hardware_concurrency());
+        std::size_t readSize = std::min<std::size_t>(std::max(options.readSize, DIRECT_IO_ALIGNMENT), 1u << 30u);
+        readSize = (readSize + DIRECT_IO_ALIGNMENT - 1) / DIRECT_IO_ALIGNMENT * DIRECT_IO_ALIGNMENT;
+        unsigned int readsInFlight = std::max(1u, std::min(options.readsInFlight, 64u));
+
+        int fd = -1;
+#ifdef O_DIRECT
+        if(options.directIo) {
+            // some file systems (ex: tmpfs) refuse O_DIRECT, so fall back to buffered reads
+            fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC | O_DIRECT);
+            stats.usedDirectIo = fd >= 0;
+        }
+#endif
+        if(fd < 0)
+            fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if(fd < 0)
+            throw std::runtime_error("can't open " + path + ": " + std::strerror(errno));
+        struct FileCloser {
+            int fd;
+            ~FileCloser() {
+                if(fd >= 0)
+                    ::close(fd);
+            }
+        } closer{fd};
+
+        struct stat st {};
+        if(::fstat(fd, &st) != 0)
+            throw std::runtime_error("can't stat " + path + ": " + std::strerror(errno));
+        if(!S_ISREG(st.st_mode))
+            throw std::runtime_error(path + " is not a regular file");
+        auto fileSize = static_cast<uint64_t>(st.st_size);
+
+        // O_DIRECT reads must start at an aligned offset, so the rest of a short read that
+        // ends elsewhere is read through a second, buffered descriptor
+        FileCloser bufferedCloser{-1};
+        auto readRest = [&](unsigned char * buffer, std::size_t length, uint64_t offset) {
+            if(bufferedCloser.fd < 0) {
+                bufferedCloser.fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+                if(bufferedCloser.fd < 0)
+                    throw std::runtime_error("can't open " + path + ": " + std::strerror(errno));
+            }
+            return length + preadFully(bufferedCloser.fd, buffer + length, readSize - length, offset + length);
+        };
+        auto needsRest = [&](std::size_t length, uint64_t offset) {
+            return stats.usedDirectIo && length < readSize && length % DIRECT_IO_ALIGNMENT != 0 &&
+                   offset + length < fileSize;
+        };
+#ifdef POSIX_FADV_SEQUENTIAL
+        if(!stats.usedDirectIo)
+            ::posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+        // enough buffers to keep every read in flight while each worker decodes one
+        std::size_t bufferCount = readsInFlight + threads;
+        std::vector<AlignedBuffer> memory;
+        for(std::size_t i = 0; i < bufferCount; ++i)
+            memory.push_back(allocateAligned(readSize));
+
+        // whole lines, ready to decode: the line that was split between the previous buffer
+        // and this one (head), then the lines that are entirely in this buffer
+        struct Unit {
+            uint64_t sequence = 0;
+            bool hasHead = false;
+            std::string head;
+            const char * begin = nullptr;
+            const char * end = nullptr;
+            int buffer = -1;   // to give back once decoded, if any
+        };
+
+        std::mutex mutex;
+        std::condition_variable unitsReady;
+        std::condition_variable turnReady;
+        std::condition_variable bufferFree;
+        std::deque<Unit> units;
+        std::vector<int> freeBuffers;
+        for(std::size_t i = bufferCount; i-- > 0;)
+            freeBuffers.push_back(static_cast<int>(i));
+        bool inputDone = false;
+        bool failed = false;
+        std::exception_ptr failure;
+        uint64_t nextTurn = 0;
+        uint64_t lineCount = 0;
+        uint64_t invalidCount = 0;
+
+        auto fail = [&](std::exception_ptr error) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if(!failed)
+                    failure = error;
+                failed = true;
+            }
+            unitsReady.notify_all();
+            turnReady.notify_all();
+            bufferFree.notify_all();
+        };
+
+        // decodes units as they come, and hands them to the handler in order
+        auto work = [&]() {
+            std::vector<DecodedLine> lines;
+            for(;;) {
+                Unit unit;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    unitsReady.wait(lock, [&] { return failed || inputDone || !units.empty(); });
+                    if(failed || units.empty())
+                        return;
+                    unit = std::move(units.front());
+                    units.pop_front();
+                }
+
+                lines.clear();
+                if(unit.hasHead) {
+                    lines.emplace_back();
+                    decodeLine(unit.head.data(), unit.head.data() + unit.head.size(), lines.back());
+                }
+                for(const char * pos = unit.begin; pos < unit.end;) {
+                    // the unit ends with a newline, so there always is one
+                    auto newline = static_cast<const char *>(std::memchr(pos, '\n', static_cast<std::size_t>(unit.end - pos)));
+                    lines.emplace_back();
+                    decodeLine(pos, newline, lines.back());
+                    pos = newline + 1;
+                }
+                uint64_t invalid = 0;
+                for(const auto & line : lines)
+                    invalid += line.valid ? 0 : 1;
+
+                uint64_t firstLine;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    turnReady.wait(lock, [&] { return failed || nextTurn == unit.sequence; });
+                    if(failed)
+                        return;
+                    firstLine = lineCount;
+                }
+                // only the worker whose turn it is gets here, so calls don't overlap
+                if(!lines.empty()) {
+                    try {
+                        handler(firstLine, lines.data(), lines.size());
+                    } catch (...) {
+                        fail(std::current_exception());
+                        return;
+                    }
+                }
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    ++nextTurn;
+                    lineCount += lines.size();
+                    invalidCount += invalid;
+                    if(unit.buffer >= 0)
+                        freeBuffers.push_back(unit.buffer);
+                }
+                turnReady.notify_all();
+                bufferFree.notify_one();
+            }
+        };
+
+        std::vector<std::thread> workers;
+        auto finish = [&]() {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                inputDone = true;
+            }
+            unitsReady.notify_all();
+            for(auto & worker : workers)
+                worker.join();
+        };
+
+        // a free buffer, or -1 if there is none (or if decoding failed)
+        auto takeBuffer = [&](bool wait) {
+            std::unique_lock<std::mutex> lock(mutex);
+            if(wait)
+                bufferFree.wait(lock, [&] { return failed || !freeBuffers.empty(); });
+            if(failed || freeBuffers.empty())
+                return -1;
+            int buffer = freeBuffers.back();
+            freeBuffers.pop_back();
+            return buffer;
+        };
+
+        // the reader's side of splitting lines between buffers. Lines longer than any txref
+        // are kept only in part, enough to still fail decoding.
+        std::string carry;
+        const std::size_t carryLimit = static_cast<std::size_t>(TXREF_MAX_INPUT_LENGTH) + 1;
+        auto appendCarry = [&](const char * data, std::size_t size) {
+            if(carry.size() < carryLimit)
+                carry.append(data, std::min(size, carryLimit - carry.size()));
+        };
+
+        uint64_t unitSequence = 0;
+        auto queueUnit = [&](Unit && unit) {
+            unit.sequence = unitSequence++;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                units.push_back(std::move(unit));
+            }
+            unitsReady.notify_one();
+        };
+
+        // turns the next buffer of the file, in order, into a unit
+        auto dispatch = [&](int buffer, std::size_t length) {
+            auto data = reinterpret_cast<const char *>(memory[static_cast<std::size_t>(buffer)].get());
+            auto first = static_cast<const char *>(std::memchr(data, '\n', length));
+            if(first == nullptr) {
+                appendCarry(data, length);
+                std::lock_guard<std::mutex> lock(mutex);
+                freeBuffers.push_back(buffer);
+                return;
+            }
+            const char * last = data + length - 1;
+            while(*last != '\n')
+                --last;
+
+            Unit unit;
+            unit.hasHead = true;
+            appendCarry(data, static_cast<std::size_t>(first - data));
+            unit.head.swap(carry);
+            unit.begin = first + 1;
+            unit.end = last + 1;
+            unit.buffer = buffer;
+            carry.clear();
+            appendCarry(last + 1, static_cast<std::size_t>(data + length - last - 1));
+            queueUnit(std::move(unit));
+        };
+
+        try {
+            for(unsigned int i = 0; i < threads; ++i)
+                workers.emplace_back(work);
+        } catch (...) {
+            fail(std::current_exception());
+            finish();
+            throw;
+        }
+
+        uint64_t nextOffset = 0;
+        bool done = false;
+
+#ifdef TXREF_USE_IO_URING
+        ReadRing ring;
+        if(options.ioUring && ring.open(readsInFlight)) {
+            stats.usedIoUring = true;
+
+            std::vector<iovec> iovecs(bufferCount);
+            for(std::size_t i = 0; i < bufferCount; ++i)
+                iovecs[i] = iovec{memory[i].get(), readSize};
+            bool registered = ring.registerBuffers(iovecs.data(), static_cast<unsigned int>(bufferCount));
+
+            struct Read {
+                uint64_t offset = 0;
+                uint64_t sequence = 0;
+                std::size_t length = 0;
+                bool ready = false;
+            };
+            std::vector<Read> reads(bufferCount);
+            uint64_t readSequence = 0;
+            uint64_t dispatchSequence = 0;
+            unsigned int pending = 0;
+
+            auto queueRead = [&](int buffer) {
+                Read & read = reads[static_cast<std::size_t>(buffer)];
+                iovec & iov = iovecs[static_cast<std::size_t>(buffer)];
+                iov.iov_base = memory[static_cast<std::size_t>(buffer)].get() + read.length;
+                iov.iov_len = readSize - read.length;
+                ring.queueRead(fd, &iov, registered ? buffer : -1, read.offset + read.length,
+                               static_cast<uint64_t>(buffer));
+            };
+
+            try {
+                for(;;) {
+                    while(pending < readsInFlight && nextOffset < fileSize) {
+                        int buffer = takeBuffer(pending == 0);
+                        if(buffer < 0)
+                            break;
+                        Read & read = reads[static_cast<std::size_t>(buffer)];
+                        read.offset = nextOffset;
+                        read.sequence = readSequence++;
+                        read.length = 0;
+                        read.ready = false;
+                        queueRead(buffer);
+                        nextOffset += readSize;
+                        ++pending;
+                    }
+                    if(pending == 0)
+                        break;
+
+                    ring.submit(1);
+                    uint64_t userData;
+                    int result;
+                    while(ring.nextCompletion(userData, result)) {
+                        auto buffer = static_cast<int>(userData);
+                        Read & read = reads[static_cast<std::size_t>(buffer)];
+                        if(result == -EINTR || result == -EAGAIN) {
+                            queueRead(buffer);
+                            continue;
+                        }
+                        if(result < 0) {
+                            --pending;   // so only the other reads are waited for below
+                            throw std::runtime_error(std::string("read failed: ") + std::strerror(-result));
+                        }
+                        read.length += readResult(static_cast<std::size_t>(result));
+                        if(result > 0 && needsRest(read.length, read.offset)) {
+                            read.length = readRest(memory[static_cast<std::size_t>(buffer)].get(), read.length,
+                                                   read.offset);
+                        }
+                        else if(result > 0 && read.length < readSize && read.offset + read.length < fileSize) {
+                            queueRead(buffer);   // a short read: ask for the rest
+                            continue;
+                        }
+                        read.ready = true;
+                        stats.bytes += read.length;
+                        --pending;
+                    }
+
+                    // reads can finish in any order, but lines are split in file order
+                    for(bool found = true; found;) {
+                        found = false;
+                        for(std::size_t i = 0; i < bufferCount; ++i) {
+                            if(reads[i].ready && reads[i].sequence == dispatchSequence) {
+                                reads[i].ready = false;
+                                dispatch(static_cast<int>(i), reads[i].length);
+                                ++dispatchSequence;
+                                found = true;
+                            }
+                        }
+                    }
+                }
+            } catch (...) {
+                // the kernel may still be writing into the buffers
+                try {
+                    while(pending > 0) {
+                        ring.submit(1);
+                        uint64_t userData;
+                        int result;
+                        while(ring.nextCompletion(userData, result))
+                            --pending;
+                    }
+                } catch (...) {
+                    // the ring can't be waited on, so leave the buffers to it (see the
+                    // decodeFile() documentation)
+                    for(auto & buffer : memory)
+                        buffer.release();
+                }
+                fail(std::current_exception());
+                finish();
+                throw;
+            }
+            done = true;
+        }
+#endif
+
+        if(!done) {
+            try {
+                while(nextOffset < fileSize) {
+                    int buffer = takeBuffer(true);
+                    if(buffer < 0)
+                        break;
+                    unsigned char * data = memory[static_cast<std::size_t>(buffer)].get();
+                    std::size_t length = preadFully(fd, data, readSize, nextOffset,
+                                                    stats.usedDirectIo ? DIRECT_IO_ALIGNMENT : 1);
+                    if(needsRest(length, nextOffset))
+                        length = readRest(data, length, nextOffset);
+                    nextOffset += readSize;
+                    stats.bytes += length;
+                    dispatch(buffer, length);
+                    if(length < readSize)
+                        break;   // the file got shorter
+                }
+            } catch (...) {
+                fail(std::current_exception());
+                finish();
+                throw;
+            }
+        }
+
+        // a last line without a newline
+        if(!carry.empty()) {
+            Unit unit;
+            unit.hasHead = true;
+            unit.head.swap(carry);
+            queueUnit(std::move(unit));
+        }
+        finish();
+        if(failure)
+            std::rethrow_exception(failure);
+
+        stats.lines = lineCount;
+        stats.invalidLines = invalidCount;
+        return stats;
+#endif
+    }
+
 }
 
 // C bindings - functions
@@ -539,6 +3008,8 @@ const char *txref_errordesc[] = {
         "Unknown error",
         "Function argument was null",
         "Function argument length was too short",
+        "Out of memory",
+        "Function argument was invalid",
         "Max error"
 };
 
@@ -821,7 +3292,14 @@ txref_error txref_decode(
     if(txref == nullptr)
         return E_TXREF_NULL_ARGUMENT;
 
-    std::string inputTxref(txref);
+    // don't measure or copy more of the input than decode() would ever accept
+    std::size_t txreflen = 0;
+    while(txref[txreflen] != '\0') {
+        if(++txreflen > static_cast<std::size_t>(txref::limits::TXREF_MAX_INPUT_LENGTH))
+            return E_TXREF_UNKNOWN_ERROR;
+    }
+
+    std::string inputTxref(txref, txreflen);
 
     txref::DecodedResult d;
     try {
@@ -852,3 +3330,364 @@ txref_error txref_decode(
 
     return E_TXREF_SUCCESS;
 }
+
+// C bindings - asynchronous jobs
+
+static_assert(TXREF_C_BUFFER_SIZE == txref::limits::TXREF_BUFFER_SIZE, "TXREF_C_BUFFER_SIZE is out of date");
+
+struct txref_context_s {
+    // a submitted job. Its items are split into chunks, which workers take from the queue.
+    // The worker that finishes the last chunk reports the job.
+    struct Job {
+        uint64_t id = 0;
+        bool encode = false;
+        bool compact = false;
+        const txref_coordinates * coordinatesIn = nullptr;   // for encode jobs
+        const char * const * txrefsIn = nullptr;             // for decode jobs
+        char * txrefsOut = nullptr;
+        txref_coordinates * coordinatesOut = nullptr;
+        txref_error * errors = nullptr;
+        txref_job_callback callback = nullptr;
+        void * userData = nullptr;
+        std::atomic<std::size_t> remaining{0};   // chunks not yet finished
+        std::atomic<std::size_t> failures{0};
+    };
+
+    struct Chunk {
+        Job * job;
+        std::size_t begin;
+        std::size_t end;
+    };
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::deque<Chunk> queue;
+    std::deque<txref_job_result> completed;   // finished jobs without a callback
+    bool stopping = false;
+    uint64_t nextId = 1;
+    std::vector<std::thread> workers;
+    int readFd = -1;
+    int writeFd = -1;   // the same as readFd for an eventfd
+};
+
+namespace {
+
+    // items per chunk: enough to make taking a chunk from the queue cheap in comparison,
+    // few enough to spread even small jobs over several workers
+    const std::size_t JOB_CHUNK_SIZE = 1024;
+
+    std::size_t encodeItems(txref_context::Job & job, std::size_t begin, std::size_t end) {
+        txref::Style style = job.compact ? txref::Style::compact : txref::Style::pretty;
+        std::size_t failures = 0;
+        for(std::size_t i = begin; i < end; ++i) {
+            char * slot = job.txrefsOut + i * TXREF_C_BUFFER_SIZE;
+            const txref_coordinates & in = job.coordinatesIn[i];
+            try {
+                std::size_t length = txref::encodeTo(
+                        slot, TXREF_C_BUFFER_SIZE - 1,
+                        txref::Coordinates(in.blockHeight, in.transactionIndex, in.txoIndex, in.magicCode), style);
+                slot[length] = '\0';
+                job.errors[i] = E_TXREF_SUCCESS;
+            } catch (std::exception &) {
+                slot[0] = '\0';
+                job.errors[i] = E_TXREF_INVALID_ARGUMENT;
+                ++failures;
+            }
+        }
+        return failures;
+    }
+
+    std::size_t decodeItems(txref_context::Job & job, std::size_t begin, std::size_t end) {
+        std::size_t failures = 0;
+        for(std::size_t i = begin; i < end; ++i) {
+            const char * in = job.txrefsIn[i];
+            if(in == nullptr) {
+                job.errors[i] = E_TXREF_NULL_ARGUMENT;
+                ++failures;
+                continue;
+            }
+            // parseTxref() rejects anything longer than this without looking at it
+            std::size_t length = 0;
+            while(length <= static_cast<std::size_t>(TXREF_MAX_INPUT_LENGTH) && in[length] != '\0')
+                ++length;
+
+            ParsedTxref parsed;
+            if(!parseTxref(in, length, parsed)) {
+                job.errors[i] = E_TXREF_INVALID_ARGUMENT;
+                ++failures;
+                continue;
+            }
+            txref::Coordinates coordinates = unpackDataPart(parsed.dp, parsed.dataSize);
+            job.coordinatesOut[i].blockHeight = coordinates.blockHeight;
+            job.coordinatesOut[i].transactionIndex = coordinates.transactionIndex;
+            job.coordinatesOut[i].txoIndex = coordinates.txoIndex;
+            job.coordinatesOut[i].magicCode = coordinates.magicCode;
+            job.errors[i] = E_TXREF_SUCCESS;
+        }
+        return failures;
+    }
+
+    // makes the context's descriptor readable. A full pipe is already readable.
+    void signalCompletion(txref_context & context) {
+#ifdef TXREF_USE_POSIX
+        uint64_t one = 1;
+        ssize_t written;
+        do {
+            written = ::write(context.writeFd, &one, sizeof(one));
+        } while(written < 0 && errno == EINTR);
+#else
+        (void)context;
+#endif
+    }
+
+    void drainCompletions(txref_context & context) {
+#ifdef TXREF_USE_POSIX
+        char buffer[64];
+        for(;;) {
+            ssize_t n = ::read(context.readFd, buffer, sizeof(buffer));
+            if(n < 0 && errno == EINTR)
+                continue;
+            if(n <= 0)
+                break;
+        }
+#else
+        (void)context;
+#endif
+    }
+
+    void runChunk(txref_context & context, const txref_context::Chunk & chunk) {
+        txref_context::Job & job = *chunk.job;
+        std::size_t failures = job.encode ? encodeItems(job, chunk.begin, chunk.end)
+                                          : decodeItems(job, chunk.begin, chunk.end);
+        if(failures > 0)
+            job.failures += failures;
+        if(--job.remaining != 0)
+            return;
+
+        // the last chunk: every output of the job has been written
+        if(job.callback != nullptr) {
+            job.callback(job.id, job.failures, job.userData);
+        }
+        else {
+            {
+                std::lock_guard<std::mutex> lock(context.mutex);
+                context.completed.push_back(txref_job_result{job.id, job.failures, job.userData});
+            }
+            signalCompletion(context);
+        }
+        delete chunk.job;
+    }
+
+    void workerLoop(txref_context * context) {
+        for(;;) {
+            txref_context::Chunk chunk;
+            {
+                std::unique_lock<std::mutex> lock(context->mutex);
+                context->wake.wait(lock, [context] { return context->stopping || !context->queue.empty(); });
+                // when stopping, the queue is still emptied, so every job finishes
+                if(context->queue.empty())
+                    return;
+                chunk = context->queue.front();
+                context->queue.pop_front();
+            }
+            runChunk(*context, chunk);
+        }
+    }
+
+    // queues the chunks of a job and takes ownership of it
+    txref_error submitJob(txref_context * context, std::unique_ptr<txref_context::Job> job, std::size_t count,
+                          uint64_t * jobId) {
+        std::size_t chunks = std::max<std::size_t>(1, (count + JOB_CHUNK_SIZE - 1) / JOB_CHUNK_SIZE);
+        job->remaining = chunks;
+        uint64_t id;
+        {
+            std::lock_guard<std::mutex> lock(context->mutex);
+            try {
+                for(std::size_t i = 0; i < chunks; ++i) {
+                    std::size_t begin = i * JOB_CHUNK_SIZE;
+                    context->queue.push_back(
+                            txref_context::Chunk{job.get(), begin, std::min(begin + JOB_CHUNK_SIZE, count)});
+                }
+            } catch (std::bad_alloc &) {
+                // no worker can have taken any of the job's chunks while the lock is held
+                while(!context->queue.empty() && context->queue.back().job == job.get())
+                    context->queue.pop_back();
+                return E_TXREF_NO_MEMORY;
+            }
+            // workers own the job from here on, and may finish it as soon as the lock is released
+            id = job->id = context->nextId++;
+            job.release();
+        }
+        if(jobId != nullptr)
+            *jobId = id;
+        if(chunks == 1)
+            context->wake.notify_one();
+        else
+            context->wake.notify_all();
+        return E_TXREF_SUCCESS;
+    }
+
+}
+
+/**
+ * Starts a pool of worker threads and returns a pointer to its context.
+ *
+ * This memory must be freed using the txref_free_context function.
+ *
+ * @return a pointer to a new txref_context, or NULL if error
+ */
+extern "C"
+txref_context * txref_create_context(unsigned int threads) {
+    if(threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+
+    txref_context * context = new (std::nothrow) txref_context;
+    if(context == nullptr)
+        return nullptr;
+
+#ifdef TXREF_USE_POSIX
+#ifdef __linux__
+    context->readFd = context->writeFd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+#else
+    int fds[2];
+    if(::pipe(fds) == 0) {
+        for(int fd : fds) {
+            ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+            ::fcntl(fd, F_SETFD, FD_CLOEXEC);
+        }
+        context->readFd = fds[0];
+        context->writeFd = fds[1];
+    }
+#endif
+    if(context->readFd < 0) {
+        delete context;
+        return nullptr;
+    }
+#endif
+
+    try {
+        for(unsigned int i = 0; i < threads; ++i)
+            context->workers.emplace_back(workerLoop, context);
+    } catch (std::exception &) {
+        txref_free_context(context);
+        return nullptr;
+    }
+    return context;
+}
+
+/**
+ * Waits for all submitted jobs to finish, then stops the worker threads and frees the context.
+ */
+extern "C"
+void txref_free_context(txref_context * context) {
+    if(context == nullptr)
+        return;
+    {
+        std::lock_guard<std::mutex> lock(context->mutex);
+        context->stopping = true;
+    }
+    context->wake.notify_all();
+    for(auto & worker : context->workers)
+        worker.join();
+#ifdef TXREF_USE_POSIX
+    if(context->writeFd != context->readFd)
+        ::close(context->writeFd);
+    ::close(context->readFd);
+#endif
+    delete context;
+}
+
+/**
+ * Returns a file descriptor that becomes readable when jobs without a callback finish.
+ */
+extern "C"
+int txref_context_fd(txref_context * context) {
+    return context != nullptr ? context->readFd : -1;
+}
+
+/**
+ * Queues a job that encodes an array of coordinates.
+ */
+extern "C"
+txref_error txref_submit_encode(
+        txref_context * context,
+        const txref_coordinates * inputs,
+        size_t count,
+        bool compact,
+        char * outputs,
+        txref_error * errors,
+        txref_job_callback callback,
+        void * userData,
+        uint64_t * jobId) {
+
+    if(context == nullptr)
+        return E_TXREF_NULL_ARGUMENT;
+    if(count > 0 && (inputs == nullptr || outputs == nullptr || errors == nullptr))
+        return E_TXREF_NULL_ARGUMENT;
+
+    std::unique_ptr<txref_context::Job> job(new (std::nothrow) txref_context::Job);
+    if(!job)
+        return E_TXREF_NO_MEMORY;
+    job->encode = true;
+    job->coordinatesIn = inputs;
+    job->compact = compact;
+    job->txrefsOut = outputs;
+    job->errors = errors;
+    job->callback = callback;
+    job->userData = userData;
+    return submitJob(context, std::move(job), count, jobId);
+}
+
+/**
+ * Queues a job that decodes an array of txrefs.
+ */
+extern "C"
+txref_error txref_submit_decode(
+        txref_context * context,
+        const char * const * inputs,
+        size_t count,
+        txref_coordinates * outputs,
+        txref_error * errors,
+        txref_job_callback callback,
+        void * userData,
+        uint64_t * jobId) {
+
+    if(context == nullptr)
+        return E_TXREF_NULL_ARGUMENT;
+    if(count > 0 && (inputs == nullptr || outputs == nullptr || errors == nullptr))
+        return E_TXREF_NULL_ARGUMENT;
+
+    std::unique_ptr<txref_context::Job> job(new (std::nothrow) txref_context::Job);
+    if(!job)
+        return E_TXREF_NO_MEMORY;
+    job->txrefsIn = inputs;
+    job->coordinatesOut = outputs;
+    job->errors = errors;
+    job->callback = callback;
+    job->userData = userData;
+    return submitJob(context, std::move(job), count, jobId);
+}
+
+/**
+ * Copies finished jobs that were submitted without a callback into results.
+ */
+extern "C"
+size_t txref_completed_jobs(
+        txref_context * context,
+        txref_job_result * results,
+        size_t maxResults) {
+
+    if(context == nullptr || results == nullptr)
+        return 0;
+
+    // reset the descriptor first, so a job that finishes after this is signalled again
+    drainCompletions(*context);
+
+    std::lock_guard<std::mutex> lock(context->mutex);
+    std::size_t n = std::min(maxResults, context->completed.size());
+    std::copy_n(context->completed.begin(), n, results);
+    context->completed.erase(context->completed.begin(), context->completed.begin() + static_cast<std::ptrdiff_t>(n));
+    if(!context->completed.empty())
+        signalCompletion(*context);
+    return n;
+}
@@ -0,0 +1,117 @@
+// Measures the per-call cost of decode(), normalize() and classifyInputString() on
+// adversarial inputs (huge strings, separator floods, mixed case) and compares it with
+// the cost of a normal txref. Oversized inputs must be rejected after a bounded amount
+// of work, so their cost should not depend on the input size: it may not exceed a small
+// multiple of the cost of the longest input that is still fully parsed.
+
+#include "libtxref.h"
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace {
+
+    // an oversized input may cost at most this many times the longest accepted input
+    const double MAX_COST_RATIO = 4.0;
+
+    const int ITERATIONS = 2000;
+
+    // average nanoseconds per call of f(input)
+    double measure(const std::function<void(const std::string &)> & f, const std::string & input) {
+        // warm up
+        for(int i = 0; i < 10; ++i)
+            f(input);
+
+        auto start = std::chrono::steady_clock::now();
+        for(int i = 0; i < ITERATIONS; ++i)
+            f(input);
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        return static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()) / ITERATIONS;
+    }
+
+    void decodeIgnoringErrors(const std::string & input) {
+        try {
+            txref::decode(input);
+        }
+        catch(const std::exception &) {
+        }
+    }
+
+    void normalizeIgnoringErrors(const std::string & input) {
+        try {
+            txref::normalize(input);
+        }
+        catch(const std::exception &) {
+        }
+    }
+
+    void classify(const std::string & input) {
+        volatile txref::InputParam result = txref::classifyInputString(input);
+        (void)result;
+    }
+
+}
+
+int main()
+{
+    const std::size_t size = 10 * 1024 * 1024;
+
+    struct Case {
+        const char * name;
+        std::string input;
+    };
+    std::vector<Case> cases = {
+            {"10 MiB of bech32 chars", std::string(size, 'q')},
+            {"10 MiB of hyphens", std::string(size, '-')},
+            {"10 MiB of mixed case", [size]() {
+                std::string s(size, 'q');
+                for(std::size_t i = 0; i < size; i += 2)
+                    s[i] = 'Q';
+                return s;
+            }()},
+            {"txref + 10 MiB padding", "tx1:rqqq-qqqq-qwtv-vjr" + std::string(size, ' ')},
+    };
+
+    // the most expensive input that is still within the bounds and is fully parsed
+    const std::string longestBounded = std::string(txref::limits::BECH32_MAX_LENGTH, 'q') +
+                                       std::string(txref::limits::TXREF_MAX_SEPARATOR_CHARS, '-');
+
+    struct Function {
+        const char * name;
+        std::function<void(const std::string &)> f;
+    };
+    std::vector<Function> functions = {
+            {"decode", decodeIgnoringErrors},
+            {"normalize", normalizeIgnoringErrors},
+            {"classifyInputString", classify},
+    };
+
+    std::printf("%-24s %-20s %12s %8s\n", "input", "function", "ns/call", "ratio");
+
+    int failures = 0;
+    for(const auto & function : functions) {
+        double valid = measure(function.f, "tx1:rqqq-qqqq-qwtv-vjr");
+        double bounded = measure(function.f, longestBounded);
+        double reference = valid > bounded ? valid : bounded;
+        std::printf("%-24s %-20s %12.0f\n", "valid txref", function.name, valid);
+        std::printf("%-24s %-20s %12.0f\n", "longest bounded input", function.name, bounded);
+
+        for(const auto & c : cases) {
+            double cost = measure(function.f, c.input);
+            double ratio = cost / reference;
+            bool ok = ratio <= MAX_COST_RATIO;
+            std::printf("%-24s %-20s %12.0f %8.2f%s\n", c.name, function.name, cost, ratio, ok ? "" : "  FAIL");
+            if(!ok)
+                ++failures;
+        }
+    }
+
+    if(failures > 0) {
+        std::printf("\n%d case(s) exceeded %.1fx the cost of the longest bounded input\n", failures, MAX_COST_RATIO);
+        return 1;
+    }
+    return 0;
+}
@@ -10,6 +10,10 @@
 #pragma GCC diagnostic pop
 
 #include "txref.cpp"
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
 
 // check that we accept block heights within the correct range
 TEST(TxrefTest, accept_good_block_heights) {
@@ -910,6 +914,79 @@ TEST(ClassifyInputStringTest, test_txid) {
     EXPECT_EQ(classifyInputString("e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca4953991b7852b855"), InputParam::unknown);
 }
 
+TEST(ClassifyInputStringTest, test_txid_not_hex) {
+    EXPECT_EQ(classifyInputString("E3B0C44298FC1C149AFBF4C8996FB92427AE41E4649B934CA495991B7852B855"), InputParam::txid);
+    EXPECT_EQ(classifyInputString("g3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855"), InputParam::unknown);
+    EXPECT_EQ(classifyInputString("e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b85 "), InputParam::unknown);
+    EXPECT_EQ(classifyInputString("e3b0c44298fc1c149afbf4c8996fb924:7ae41e4649b934ca495991b7852b855"), InputParam::unknown);
+    EXPECT_EQ(classifyInputString(std::string(64, '\xff')), InputParam::unknown);
+}
+
+RC_GTEST_PROP(TxrefTestRC, txidParsingMatchesReferenceParsing, ()
+) {
+    // mostly hex chars, with an occasional char from anywhere in the byte range
+    auto hexChar = rc::gen::elementOf(std::string("0123456789abcdefABCDEF"));
+    auto anyChar = rc::gen::arbitrary<char>();
+    auto chars = *rc::gen::container<std::vector<char>>(
+            TXID_LENGTH, rc::gen::weightedOneOf<char>({{30, hexChar}, {1, anyChar}}));
+
+    bool expectedValid = std::all_of(chars.begin(), chars.end(), [](char c) {
+        return std::isxdigit(static_cast<unsigned char>(c)) != 0;
+    });
+    unsigned char expected[TXID_SIZE] = {};
+    for(int i = 0; expectedValid && i < TXID_SIZE; ++i) {
+        std::string byte(chars.data() + 2 * i, 2);
+        expected[TXID_SIZE - 1 - i] = static_cast<unsigned char>(std::stoul(byte, nullptr, 16));
+    }
+
+    unsigned char actual[TXID_SIZE] = {};
+    bool actualValid = parseTxidHex(chars.data(), actual);
+
+    RC_ASSERT(expectedValid == actualValid);
+    if(expectedValid)
+        RC_ASSERT(std::equal(expected, expected + TXID_SIZE, actual));
+}
+
+// check that the scalar and the SSE2 txid parsers agree, so the scalar one stays tested
+// on targets that use the other
+RC_GTEST_PROP(TxrefTestRC, txidParsingScalarMatchesSse2, ()
+) {
+    auto hexChar = rc::gen::elementOf(std::string("0123456789abcdefABCDEF"));
+    auto anyChar = rc::gen::arbitrary<char>();
+    auto chars = *rc::gen::container<std::vector<char>>(
+            TXID_LENGTH, rc::gen::weightedOneOf<char>({{30, hexChar}, {1, anyChar}}));
+
+    unsigned char scalar[TXID_SIZE] = {};
+    bool scalarValid = parseTxidScalar(chars.data(), scalar);
+    RC_ASSERT(parseTxidScalar(chars.data(), nullptr) == scalarValid);
+#ifdef TXREF_USE_SSE2
+    unsigned char sse2[TXID_SIZE] = {};
+    RC_ASSERT(parseTxidSse2(chars.data(), sse2) == scalarValid);
+    if(scalarValid)
+        RC_ASSERT(std::equal(scalar, scalar + TXID_SIZE, sse2));
+#endif
+}
+
+// check that a txid with a bad char near the end leaves the output alone, so batch
+// classification leaves its slot zeroed rather than partly decoded
+TEST(TxrefTest, txidParsingFailureLeavesOutputAlone) {
+    std::string hex = "4a5e1e4baab89f3a32518a88c31bc87f618f76673e2cc77ab2127b7afdeda33b";
+    std::string bad = hex.substr(0, TXID_LENGTH - 2) + "z" + hex.substr(TXID_LENGTH - 1);
+
+    unsigned char txid[TXID_SIZE];
+    std::fill(txid, txid + TXID_SIZE, 0xee);
+    EXPECT_FALSE(parseTxidScalar(bad.data(), txid));
+    EXPECT_TRUE(std::all_of(txid, txid + TXID_SIZE, [](unsigned char c) { return c == 0xee; }));
+    EXPECT_FALSE(parseTxidHex(bad.data(), txid));
+    EXPECT_TRUE(std::all_of(txid, txid + TXID_SIZE, [](unsigned char c) { return c == 0xee; }));
+
+    std::vector<unsigned char> txids;
+    std::vector<InputParam> results = classifyInputStrings({hex, bad}, &txids);
+    ASSERT_EQ(txids.size(), 2u * TXID_SIZE);
+    EXPECT_EQ(results[1], InputParam::unknown);
+    EXPECT_TRUE(std::all_of(txids.begin() + TXID_SIZE, txids.end(), [](unsigned char c) { return c == 0; }));
+}
+
 TEST(ClassifyInputStringTest, test_txref) {
     // mainnet
     EXPECT_EQ(classifyInputString("tx1rqqqqqqqqwtvvjr"), InputParam::txref);
@@ -934,6 +1011,323 @@ TEST(ClassifyInputStringTest, test_txrefext) {
     EXPECT_EQ(classifyInputString("p7lllllllpqqqa0dvp"), InputParam::txrefext);
 }
 
+// check that oversized inputs are rejected by the bounded pre-scan
+TEST(TxrefTest, inputBounds) {
+    std::string txref = "tx1:rqqq-qqqq-qwtv-vjr";
+    EXPECT_TRUE(isWithinInputBounds(txref.data(), txref.length()));
+
+    std::string longest(BECH32_MAX_LENGTH, 'q');
+    EXPECT_TRUE(isWithinInputBounds(longest.data(), longest.length()));
+    longest += 'q';
+    EXPECT_FALSE(isWithinInputBounds(longest.data(), longest.length()));
+
+    std::string separators(TXREF_MAX_SEPARATOR_CHARS, '-');
+    EXPECT_TRUE(isWithinInputBounds(separators.data(), separators.length()));
+    separators += '-';
+    EXPECT_FALSE(isWithinInputBounds(separators.data(), separators.length()));
+
+    // the length check alone rejects this without reading the (uninitialized) contents
+    EXPECT_FALSE(isWithinInputBounds(txref.data(), TXREF_MAX_INPUT_LENGTH + 1));
+}
+
+namespace {
+    std::string sha256Hex(const std::vector<std::string> & pieces) {
+        Sha256 sha;
+        for(const auto & piece : pieces)
+            sha.update(reinterpret_cast<const unsigned char *>(piece.data()), piece.length());
+        unsigned char digest[32];
+        sha.finish(digest);
+
+        std::ostringstream out;
+        for(unsigned char c : digest)
+            out << std::hex << std::setw(2) << std::setfill('0') << static_cast<int>(c);
+        return out.str();
+    }
+}
+
+namespace {
+    // the bech32 checksum step as written in BIP-0173, one branch per generator
+    uint32_t polymodStepBitwise(uint32_t chk, uint8_t value) {
+        uint32_t top = chk >> 25u;
+        chk = ((chk & 0x1FFFFFFu) << 5u) ^ value;
+        if(top & 0x01u) chk ^= 0x3B6A57B2u;
+        if(top & 0x02u) chk ^= 0x26508E6Du;
+        if(top & 0x04u) chk ^= 0x1EA119FAu;
+        if(top & 0x08u) chk ^= 0x3D4233DDu;
+        if(top & 0x10u) chk ^= 0x2A1462B3u;
+        return chk;
+    }
+}
+
+// check that the table-driven checksum step matches the bitwise one, both for a single
+// step and for a whole data part
+RC_GTEST_PROP(TxrefTestRC, polymodStepMatchesBitwiseStep, ()
+) {
+    auto chk = *rc::gen::inRange<uint32_t>(0, 1u << 30u);
+    auto value = *rc::gen::inRange<uint8_t>(0, 32);
+    RC_ASSERT(polymodStep(chk, value) == polymodStepBitwise(chk, value));
+
+    auto values = *rc::gen::container<std::vector<uint8_t>>(rc::gen::inRange<uint8_t>(0, 32));
+    uint32_t table = 1, bitwise = 1;
+    for(uint8_t v : values) {
+        table = polymodStep(table, v);
+        bitwise = polymodStepBitwise(bitwise, v);
+    }
+    RC_ASSERT(table == bitwise);
+}
+
+RC_GTEST_PROP(TxrefTestRC, unpackDataPartReversesPackDataPart, ()
+) {
+    auto height = *rc::gen::inRange(0, 0xFFFFFF); // MAX_BLOCK_HEIGHT
+    auto pos = *rc::gen::inRange(0, 0x7FFF); // MAX_TRANSACTION_INDEX
+    auto index = *rc::gen::inRange(0, 0x7FFF); // MAX_TXO_INDEX
+
+    unsigned char dp[DATA_EXTENDED_SIZE];
+    auto dataSize = packDataPart(dp, txref::Coordinates(height, pos, index, txref::MAGIC_CODE_TEST_EXTENDED));
+    auto coordinates = unpackDataPart(dp, dataSize);
+
+    RC_ASSERT(coordinates.blockHeight == height);
+    RC_ASSERT(coordinates.transactionIndex == pos);
+    RC_ASSERT(coordinates.txoIndex == index);
+    RC_ASSERT(coordinates.magicCode == txref::MAGIC_CODE_TEST_EXTENDED);
+}
+
+// check the SHA-256 used for txids against the FIPS 180-4 examples
+TEST(TxrefTest, sha256) {
+    EXPECT_EQ(sha256Hex({""}),
+              "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855");
+    EXPECT_EQ(sha256Hex({"abc"}),
+              "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+    EXPECT_EQ(sha256Hex({"abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq"}),
+              "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1");
+    EXPECT_EQ(sha256Hex({std::string(1000000, 'a')}),
+              "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0");
+}
+
+RC_GTEST_PROP(TxrefTestRC, sha256IsIndependentOfHowInputIsSplit, ()
+) {
+    auto input = *rc::gen::container<std::string>(rc::gen::arbitrary<char>());
+    auto cut1 = *rc::gen::inRange<std::size_t>(0, input.length() + 1);
+    auto cut2 = *rc::gen::inRange<std::size_t>(cut1, input.length() + 1);
+
+    RC_ASSERT(sha256Hex({input.substr(0, cut1), input.substr(cut1, cut2 - cut1), input.substr(cut2)}) ==
+              sha256Hex({input}));
+}
+
+namespace {
+    // a header on top of 'previous' (nullptr for a genesis block) with the given time and
+    // compact target. 'nonce' tells apart headers that would otherwise be identical.
+    std::vector<unsigned char> makeHeader(const unsigned char * previous, uint32_t time, uint32_t bits, uint32_t nonce) {
+        std::vector<unsigned char> header(BLOCK_HEADER_SIZE, 0);
+        if(previous != nullptr)
+            blockHash(previous, &header[HEADER_PREVIOUS_HASH_OFFSET]);
+        storeLittleEndian(&header[HEADER_TIME_OFFSET], time, 4);
+        storeLittleEndian(&header[HEADER_BITS_OFFSET], bits, 4);
+        storeLittleEndian(&header[76], nonce, 4);
+        return header;
+    }
+
+    void append(std::vector<unsigned char> & headers, const std::vector<unsigned char> & header) {
+        headers.insert(headers.end(), header.begin(), header.end());
+    }
+}
+
+// check that the chain with the most work wins, not the longest one, and that stale and
+// unconnected headers are ignored
+TEST(TxrefTest, blockTimeIndex_mostWork) {
+    const uint32_t easy = 0x1d00ffff;
+    const uint32_t hard = 0x1c00ffff; // 256 times the work
+
+    std::vector<unsigned char> headers;
+    auto genesis = makeHeader(nullptr, 1000, easy, 0);
+    append(headers, genesis);
+
+    // a long, easy branch
+    auto previous = genesis;
+    for(uint32_t i = 1; i <= 5; ++i) {
+        auto header = makeHeader(previous.data(), 1000 + i * 600, easy, 1);
+        append(headers, header);
+        previous = header;
+    }
+
+    // a short, hard branch, given before its parent
+    auto hard1 = makeHeader(genesis.data(), 7000, hard, 2);
+    auto hard2 = makeHeader(hard1.data(), 8000, hard, 2);
+    append(headers, hard2);
+    append(headers, hard1);
+
+    // a header whose parent is missing, and a duplicate
+    auto orphan = makeHeader(hard2.data(), 9000, hard, 3);
+    append(headers, makeHeader(orphan.data(), 9600, hard, 3));
+    append(headers, hard1);
+
+    auto index = txref::BlockTimeIndex::fromUnorderedHeaders(headers.data(), headers.size() / BLOCK_HEADER_SIZE);
+    ASSERT_EQ(index.size(), 3u);
+    EXPECT_EQ(index.blockTime(0), 1000u);
+    EXPECT_EQ(index.blockTime(1), 7000u);
+    EXPECT_EQ(index.blockTime(2), 8000u);
+}
+
+// check that many copies of the same headers, the genesis block among them, are linked as one
+TEST(TxrefTest, blockTimeIndex_duplicateHeaders) {
+    auto genesis = makeHeader(nullptr, 1000, 0x1d00ffff, 0);
+    auto block1 = makeHeader(genesis.data(), 1600, 0x1d00ffff, 0);
+    auto block2 = makeHeader(block1.data(), 2200, 0x1d00ffff, 0);
+
+    for(int copies : {2, 17, 40, 100}) {
+        std::vector<unsigned char> headers;
+        append(headers, block2);
+        for(int i = 0; i < copies; ++i) {
+            append(headers, genesis);
+            if(i % 3 == 0)
+                append(headers, block1);
+            if(i % 5 == 0)
+                append(headers, block2);
+        }
+
+        auto index = txref::BlockTimeIndex::fromUnorderedHeaders(headers.data(), headers.size() / BLOCK_HEADER_SIZE);
+        ASSERT_EQ(index.size(), 3u) << copies << " copies";
+        EXPECT_EQ(index.blockTime(0), 1000u);
+        EXPECT_EQ(index.blockTime(1), 1600u);
+        EXPECT_EQ(index.blockTime(2), 2200u);
+    }
+}
+
+// check that timestamps which make median-time-past decrease, which no valid chain has, are rejected
+TEST(TxrefTest, blockTimeIndex_decreasingMedianTime) {
+    std::vector<unsigned char> headers;
+    std::vector<unsigned char> previous;
+    for(uint32_t time : {1000u, 2000u, 500u}) {
+        auto header = makeHeader(previous.empty() ? nullptr : previous.data(), time, 0x1d00ffff, 0);
+        append(headers, header);
+        previous = header;
+    }
+    EXPECT_NO_THROW(txref::BlockTimeIndex::fromHeaders(headers.data(), 2));
+    EXPECT_THROW(txref::BlockTimeIndex::fromHeaders(headers.data(), 3), std::runtime_error);
+    EXPECT_THROW(txref::BlockTimeIndex::fromUnorderedHeaders(headers.data(), 3), std::runtime_error);
+}
+
+// check that height ranges match a scan over all blocks, with out-of-order timestamps
+RC_GTEST_PROP(TxrefTestRC, blockTimeIndexRangesMatchScan, ()
+) {
+    auto count = *rc::gen::inRange(1, 60);
+    std::vector<unsigned char> headers;
+    std::vector<uint32_t> times;
+    std::vector<unsigned char> previous;
+    for(int i = 0; i < count; ++i) {
+        auto time = static_cast<uint32_t>(1000 + i * 10 + *rc::gen::inRange(-25, 25));
+        if(i > 0) {
+            // consensus requires each timestamp to be after the previous median-time-past
+            std::vector<uint32_t> last(times.end() - std::min<std::ptrdiff_t>(i, 11), times.end());
+            std::sort(last.begin(), last.end());
+            time = std::max(time, last[last.size() / 2] + 1);
+        }
+        auto header = makeHeader(i == 0 ? nullptr : previous.data(), time, 0x1d00ffff, 0);
+        append(headers, header);
+        times.push_back(time);
+        previous = header;
+    }
+    auto index = txref::BlockTimeIndex::fromHeaders(headers.data(), times.size());
+
+    auto begin = static_cast<uint32_t>(*rc::gen::inRange(950, 1700));
+    auto end = static_cast<uint32_t>(*rc::gen::inRange(950, 1700));
+    auto range = index.heightRange(begin, end);
+    auto medianRange = index.heightRangeByMedianTime(begin, end);
+
+    for(int h = 0; h < count; ++h) {
+        if(times[static_cast<std::size_t>(h)] >= begin && times[static_cast<std::size_t>(h)] < end)
+            RC_ASSERT(h >= range.first && h < range.second);
+        bool inMedianRange = index.medianTimePast(h) >= begin && index.medianTimePast(h) < end;
+        RC_ASSERT(inMedianRange == (h >= medianRange.first && h < medianRange.second));
+        if(h > 0)
+            RC_ASSERT(index.medianTimePast(h) >= index.medianTimePast(h - 1));
+    }
+}
+
+// check that merging distinct counters gives the same estimate as counting everything in one
+RC_GTEST_PROP(TxrefTestRC, distinctCounterMergeMatchesSingleCounter, ()
+) {
+    auto keys = *rc::gen::container<std::vector<uint64_t>>(rc::gen::inRange<uint64_t>(0, 1000));
+    auto split = *rc::gen::inRange<std::size_t>(0, keys.size() + 1);
+    txref::detail::DistinctCounter all, first, second;
+    for(std::size_t i = 0; i < keys.size(); ++i) {
+        all.add(distinctHash(keys[i]));
+        (i < split ? first : second).add(distinctHash(keys[i]));
+    }
+    first.merge(second);
+    RC_ASSERT(first.estimate() == all.estimate());
+
+    std::sort(keys.begin(), keys.end());
+    auto distinct = static_cast<uint64_t>(std::unique(keys.begin(), keys.end()) - keys.begin());
+    if(distinct <= DISTINCT_EXACT_LIMIT)
+        RC_ASSERT(all.estimate() == distinct);
+}
+
+// check that a distinct counter's memory follows its count until it reaches the sketch's
+// size, and never goes past it
+TEST(TxrefTest, distinctCounterMemory) {
+    txref::detail::DistinctCounter counter;
+    EXPECT_EQ(counter.bytes(), 0u);
+    uint64_t key = 0;
+    for(; key < 6; ++key)
+        counter.add(distinctHash(key));
+    EXPECT_EQ(counter.bytes(), DISTINCT_TABLE_MIN_SIZE * sizeof(uint64_t));
+    for(; key < 90; ++key)
+        counter.add(distinctHash(key));
+    EXPECT_EQ(counter.estimate(), 90u);
+    EXPECT_EQ(counter.bytes(), 1024u);
+    for(; key < DISTINCT_EXACT_LIMIT; ++key)
+        counter.add(distinctHash(key));
+    EXPECT_EQ(counter.estimate(), DISTINCT_EXACT_LIMIT);
+    EXPECT_EQ(counter.bytes(), DISTINCT_REGISTERS);
+    for(; key < 100000; ++key)
+        counter.add(distinctHash(key));
+    EXPECT_EQ(counter.bytes(), DISTINCT_REGISTERS);
+}
+
+#ifdef TXREF_USE_POSIX
+// check that decodeFile() goes on after short reads, including ones that leave an O_DIRECT
+// read at an unaligned offset
+TEST(TxrefTest, decodeFileShortReads) {
+    const std::string path = "decodeFileShortReads.txt";
+    std::vector<txref::Coordinates> expected;
+    {
+        std::ofstream out(path, std::ios::binary);
+        for(int i = 0; i < 3000; ++i) {
+            expected.emplace_back(i * 11, i % 1000, 0, txref::MAGIC_CODE_MAIN);
+            out << expected.back() << "\n";
+        }
+    }
+
+    for(std::size_t limit : {std::size_t(1000), DIRECT_IO_ALIGNMENT}) {
+        for(bool ioUring : {true, false}) {
+            txref::FileDecodeOptions options;
+            options.readSize = 3 * DIRECT_IO_ALIGNMENT;
+            options.threads = 2;
+            options.ioUring = ioUring;
+            options.directIo = true;
+
+            std::vector<txref::DecodedLine> lines;
+            testReadLimit = limit;
+            txref::FileDecodeStats stats;
+            EXPECT_NO_THROW(stats = txref::decodeFile(path, [&](std::uint64_t, const txref::DecodedLine * decoded, std::size_t count) {
+                lines.insert(lines.end(), decoded, decoded + count);
+            }, options)) << "limit " << limit << ", io_uring " << ioUring;
+            testReadLimit = 0;
+
+            ASSERT_EQ(lines.size(), expected.size()) << "limit " << limit << ", io_uring " << ioUring;
+            for(std::size_t i = 0; i < lines.size(); ++i) {
+                EXPECT_TRUE(lines[i].valid) << "line " << i;
+                EXPECT_EQ(lines[i].coordinates.blockHeight, expected[i].blockHeight) << "line " << i;
+                EXPECT_EQ(lines[i].coordinates.transactionIndex, expected[i].transactionIndex) << "line " << i;
+            }
+            EXPECT_EQ(stats.invalidLines, 0u);
+        }
+    }
+    std::remove(path.c_str());
+}
+#endif
+
 TEST(TxrefTest, containsUppercaseCharacters) {
     EXPECT_FALSE(cleanTxrefContainsUppercaseCharacters("test"));
     EXPECT_TRUE(cleanTxrefContainsUppercaseCharacters("TEST"));
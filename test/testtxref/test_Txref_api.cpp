@@ -10,6 +10,11 @@
 #pragma GCC diagnostic pop
 
 #include "libtxref.h"
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
 
 // In this "API" test file, we should only be referring to symbols in the "txref" namespace.
 
@@ -414,6 +419,271 @@ TEST(TxrefApiTest, txref_extended_encode_force_zero) {
               "txrt1:p7ll-llqq-qqqq-cqa8-44");
 }
 
+// check that encodeTo writes the same txrefs as encode, in each style
+TEST(TxrefApiTest, txref_encodeTo) {
+    char buffer[txref::limits::TXREF_MAX_LENGTH];
+    std::size_t length;
+
+    length = txref::encodeTo(buffer, sizeof(buffer), txref::Coordinates(466793, 2205));
+    EXPECT_EQ(std::string(buffer, length), "tx1:rjk0-uqay-z9l7-m9m");
+
+    length = txref::encodeTo(buffer, sizeof(buffer),
+                             txref::Coordinates(466793, 2205, 10, txref::MAGIC_CODE_TEST_EXTENDED));
+    EXPECT_EQ(std::string(buffer, length), "txtest1:8jk0-uqay-z2qq-dlc3-z6");
+    EXPECT_EQ(length, static_cast<std::size_t>(txref::limits::TXREF_MAX_LENGTH));
+
+    length = txref::encodeTo(buffer, sizeof(buffer),
+                             txref::Coordinates(0, 0, 0, txref::MAGIC_CODE_MAIN_EXTENDED));
+    EXPECT_EQ(std::string(buffer, length), "tx1:yqqq-qqqq-qqqq-rvum-0c");
+
+    length = txref::encodeTo(buffer, sizeof(buffer),
+                             txref::Coordinates(0xFFFFFF, 0x7FFF, 0, txref::MAGIC_CODE_REGTEST),
+                             txref::Style::compact);
+    EXPECT_EQ(std::string(buffer, length), "txrt1q7lllllllps4p3p");
+
+    length = txref::encodeTo(buffer, sizeof(buffer), txref::Coordinates(466793, 2205),
+                             txref::Style::compact, true);
+    EXPECT_EQ(std::string(buffer, length), "TX1RJK0UQAYZ9L7M9M");
+
+    length = txref::encodeTo(buffer, sizeof(buffer), txref::Coordinates(466793, 2205),
+                             txref::Style::pretty, true);
+    EXPECT_EQ(std::string(buffer, length), "TX1:RJK0-UQAY-Z9L7-M9M");
+}
+
+// check that encodeTo rejects bad coordinates and short buffers
+TEST(TxrefApiTest, txref_encodeTo_errors) {
+    char buffer[txref::limits::TXREF_MAX_LENGTH];
+
+    EXPECT_THROW(txref::encodeTo(buffer, sizeof(buffer), txref::Coordinates(-1, 0)), std::runtime_error);
+    EXPECT_THROW(txref::encodeTo(buffer, sizeof(buffer), txref::Coordinates(0, 0, 1)), std::runtime_error);
+    EXPECT_THROW(txref::encodeTo(buffer, sizeof(buffer), txref::Coordinates(0, 0, 0, 0x1F)), std::runtime_error);
+    EXPECT_THROW(txref::encodeTo(buffer, 21, txref::Coordinates(0, 0)), std::runtime_error);
+    EXPECT_NO_THROW(txref::encodeTo(buffer, 22, txref::Coordinates(0, 0)));
+    EXPECT_THROW(txref::encodeTo(nullptr, 0, txref::Coordinates(0, 0)), std::runtime_error);
+}
+
+// check that Coordinates can be written to a stream, honoring the manipulators
+TEST(TxrefApiTest, txref_stream_insertion) {
+    std::ostringstream ss;
+
+    ss << txref::Coordinates(10000, 2, 3, txref::MAGIC_CODE_MAIN_EXTENDED);
+    EXPECT_EQ(ss.str(), "tx1:yq3n-qqzq-qrqq-9z4d-2n");
+
+    ss.str("");
+    ss << txref::compact << txref::Coordinates(10000, 2) << ' ' << txref::Coordinates(10000, 4, 0, txref::MAGIC_CODE_TEST);
+    EXPECT_EQ(ss.str(), "tx1rq3nqqzqqk8kmzd txtest1xq3nqqyqqhrggy3");
+
+    ss.str("");
+    ss << std::uppercase << txref::pretty << txref::Coordinates(10000, 2);
+    EXPECT_EQ(ss.str(), "TX1:RQ3N-QQZQ-QK8K-MZD");
+}
+
+// check that stream insertion pads to the field width and fails without throwing
+TEST(TxrefApiTest, txref_stream_insertion_formatting) {
+    std::ostringstream ss;
+
+    ss << txref::compact << std::setw(20) << txref::Coordinates(0, 0) << '|' << txref::Coordinates(0, 0);
+    EXPECT_EQ(ss.str(), "  tx1rqqqqqqqqwtvvjr|tx1rqqqqqqqqwtvvjr");
+
+    ss.str("");
+    ss << std::left << std::setfill('.') << std::setw(20) << txref::Coordinates(0, 0) << '|';
+    EXPECT_EQ(ss.str(), "tx1rqqqqqqqqwtvvjr..|");
+
+    ss.str("");
+    ss << std::setw(4) << txref::Coordinates(0, 0);
+    EXPECT_EQ(ss.str(), "tx1rqqqqqqqqwtvvjr");
+
+    ss.str("");
+    EXPECT_NO_THROW(ss << std::setw(30) << txref::Coordinates(-1, 0));
+    EXPECT_TRUE(ss.fail());
+    EXPECT_FALSE(ss.bad());
+    EXPECT_EQ(ss.str(), "");
+    EXPECT_EQ(ss.width(), 0);
+
+    ss.clear();
+    ss.exceptions(std::ios_base::failbit);
+    EXPECT_THROW(ss << txref::Coordinates(0, 0, 0, 0x1F), std::ios_base::failure);
+}
+
+RC_GTEST_PROP(TxrefApiTestRC, checkThatEncodeToMatchesEncode, ()
+) {
+    auto height = *rc::gen::inRange(0, 0xFFFFFF); // MAX_BLOCK_HEIGHT
+    auto pos = *rc::gen::inRange(0, 0x7FFF); // MAX_TRANSACTION_INDEX
+    auto index = *rc::gen::inRange(0, 0x7FFF); // MAX_TXO_INDEX
+
+    char buffer[txref::limits::TXREF_MAX_LENGTH];
+    auto length = txref::encodeTo(buffer, sizeof(buffer),
+                                  txref::Coordinates(height, pos, index, txref::MAGIC_CODE_MAIN_EXTENDED));
+    RC_ASSERT(std::string(buffer, length) == txref::encode(height, pos, index, true));
+
+    length = txref::encodeTo(buffer, sizeof(buffer),
+                             txref::Coordinates(height, pos, 0, txref::MAGIC_CODE_TEST));
+    RC_ASSERT(std::string(buffer, length) == txref::encodeTestnet(height, pos));
+}
+
+// check that decodeTo decodes what decode does, in any style or case
+RC_GTEST_PROP(TxrefApiTestRC, checkThatDecodeToMatchesDecode, ()
+) {
+    auto height = *rc::gen::inRange(0, 0xFFFFFF); // MAX_BLOCK_HEIGHT
+    auto pos = *rc::gen::inRange(0, 0x7FFF); // MAX_TRANSACTION_INDEX
+    auto index = *rc::gen::inRange(0, 0x7FFF); // MAX_TXO_INDEX
+    auto magicCode = *rc::gen::element(txref::MAGIC_CODE_MAIN_EXTENDED, txref::MAGIC_CODE_TEST_EXTENDED);
+    auto style = *rc::gen::element(txref::Style::pretty, txref::Style::compact);
+    auto uppercase = *rc::gen::arbitrary<bool>();
+
+    char buffer[txref::limits::TXREF_MAX_LENGTH];
+    auto length = txref::encodeTo(buffer, sizeof(buffer), txref::Coordinates(height, pos, index, magicCode),
+                                  style, uppercase);
+    std::string encoded(buffer, length);
+
+    txref::Coordinates coordinates;
+    RC_ASSERT(txref::decodeTo(encoded.data(), encoded.length(), coordinates));
+    auto decoded = txref::decode(encoded);
+    RC_ASSERT(coordinates.blockHeight == decoded.blockHeight);
+    RC_ASSERT(coordinates.transactionIndex == decoded.transactionIndex);
+    RC_ASSERT(coordinates.txoIndex == decoded.txoIndex);
+    RC_ASSERT(coordinates.magicCode == decoded.magicCode);
+
+    // a corrupted txref is rejected and leaves the coordinates alone
+    auto at = *rc::gen::inRange<std::size_t>(0, encoded.length());
+    encoded[at] = encoded[at] == 'q' ? 'p' : 'q';
+    txref::Coordinates unchanged(1, 2, 3, txref::MAGIC_CODE_REGTEST_EXTENDED);
+    bool valid = txref::decodeTo(encoded.data(), encoded.length(), unchanged);
+    bool decodes = true;
+    try {
+        txref::decode(encoded);
+    }
+    catch(const std::exception &) {
+        decodes = false;
+    }
+    RC_ASSERT(valid == decodes);
+    if(!valid)
+        RC_ASSERT(unchanged.blockHeight == 1 && unchanged.transactionIndex == 2 && unchanged.txoIndex == 3);
+}
+
+// check that decodeTo rejects what isn't a txref
+TEST(TxrefApiTest, txref_decodeTo_invalid) {
+    txref::Coordinates coordinates;
+    EXPECT_FALSE(txref::decodeTo(nullptr, 0, coordinates));
+    EXPECT_FALSE(txref::decodeTo("", 0, coordinates));
+    EXPECT_FALSE(txref::decodeTo("bogus", 5, coordinates));
+    std::string longInput(1000, 'q');
+    EXPECT_FALSE(txref::decodeTo(longInput.data(), longInput.length(), coordinates));
+    EXPECT_TRUE(txref::decodeTo("rjk0-uqay-z9l7-m9m", 18, coordinates));
+    EXPECT_EQ(coordinates.blockHeight, 466793);
+    EXPECT_EQ(coordinates.transactionIndex, 2205);
+}
+
+// check that encodeCompact returns encode's txref without separators
+TEST(TxrefApiTest, txref_encodeCompact) {
+    EXPECT_EQ(txref::encodeCompact(0, 0), "tx1rqqqqqqqqwtvvjr");
+    EXPECT_EQ(txref::encodeCompact(466793, 2205), "tx1rjk0uqayz9l7m9m");
+    EXPECT_EQ(txref::encodeCompact(10000, 2, 3), "tx1yq3nqqzqqrqq9z4d2n");
+    EXPECT_EQ(txref::encodeCompact(0, 0, 0, true), "tx1yqqqqqqqqqqqrvum0c");
+    EXPECT_THROW(txref::encodeCompact(-1, 0), std::runtime_error);
+}
+
+// check that every accepted form of a txref normalizes to the same compact key
+TEST(TxrefApiTest, txref_normalize) {
+    EXPECT_EQ(txref::normalize("tx1:rjk0-uqay-z9l7-m9m"), "tx1rjk0uqayz9l7m9m");
+    EXPECT_EQ(txref::normalize("TX1:RJK0-UQAY-Z9L7-M9M"), "tx1rjk0uqayz9l7m9m");
+    EXPECT_EQ(txref::normalize("tx1:rJK0-uqay-Z9L7-m9m"), "tx1rjk0uqayz9l7m9m");
+    EXPECT_EQ(txref::normalize("rjk0-uqay-z9l7-m9m"), "tx1rjk0uqayz9l7m9m");
+    EXPECT_EQ(txref::normalize("tx1.rjk0.uqay.z9l7.m9m"), "tx1rjk0uqayz9l7m9m");
+    EXPECT_EQ(txref::normalize("tx1rjk0uqayz9l7m9m"), "tx1rjk0uqayz9l7m9m");
+
+    // original bech32 checksum is replaced with bech32m
+    EXPECT_EQ(txref::normalize("txtest1:xjk0-uqay-zat0-dz8"), "txtest1xjk0uqayzghlp89");
+    EXPECT_EQ(txref::normalize("xjk0-uqay-zghl-p89"), "txtest1xjk0uqayzghlp89");
+
+    EXPECT_EQ(txref::normalize("txtest1:8jk0-uqay-z2qq-dlc3-z6"), "txtest18jk0uqayz2qqdlc3z6");
+    EXPECT_EQ(txref::normalize("pqqq-qqqq-qyrq-2z0a-kx"), "txrt1pqqqqqqqqyrq2z0akx");
+
+    EXPECT_THROW(txref::normalize(""), std::runtime_error);
+    EXPECT_THROW(txref::normalize("tx1:rjk0-uqay-z9l7-m9n"), std::runtime_error); // bad checksum
+    EXPECT_THROW(txref::normalize("tx1:rjk0-uqay-z9l7"), std::runtime_error);     // too short
+    EXPECT_THROW(txref::normalize("jk0-uqay-z9l7-m9m"), std::runtime_error);      // no HRP, bad length
+}
+
+// check that batch normalization keeps results aligned with the input
+TEST(TxrefApiTest, txref_normalize_batch) {
+    std::vector<std::string> input = {"TX1:RJK0-UQAY-Z9L7-M9M", "garbage", "txtest1:xjk0-uqay-zat0-dz8"};
+    std::vector<std::string> output = txref::normalize(input);
+    ASSERT_EQ(output.size(), 3u);
+    EXPECT_EQ(output[0], "tx1rjk0uqayz9l7m9m");
+    EXPECT_EQ(output[1], "");
+    EXPECT_EQ(output[2], "txtest1xjk0uqayzghlp89");
+}
+
+RC_GTEST_PROP(TxrefApiTestRC, checkThatNormalizeMatchesEncodeCompact, ()
+) {
+    auto height = *rc::gen::inRange(0, 0xFFFFFF); // MAX_BLOCK_HEIGHT
+    auto pos = *rc::gen::inRange(0, 0x7FFF); // MAX_TRANSACTION_INDEX
+    auto index = *rc::gen::inRange(0, 0x7FFF); // MAX_TXO_INDEX
+
+    auto compact = txref::encodeCompact(height, pos, index, true);
+    RC_ASSERT(txref::normalize(txref::encode(height, pos, index, true)) == compact);
+    RC_ASSERT(txref::normalize(txref::decode(compact).txref) == compact);
+}
+
+// check that txids are validated and decoded in reversed byte order
+TEST(TxrefApiTest, txid_parse) {
+    // the genesis block's coinbase transaction
+    std::string hex = "4a5e1e4baab89f3a32518a88c31bc87f618f76673e2cc77ab2127b7afdeda33b";
+    unsigned char txid[txref::limits::TXID_SIZE];
+
+    EXPECT_TRUE(txref::parseTxid(hex));
+    EXPECT_TRUE(txref::parseTxid(hex, txid));
+    EXPECT_EQ(txid[0], 0x3b);
+    EXPECT_EQ(txid[1], 0xa3);
+    EXPECT_EQ(txid[30], 0x5e);
+    EXPECT_EQ(txid[31], 0x4a);
+
+    EXPECT_EQ(txref::classifyInputString(hex, txid), txref::InputParam::txid);
+    EXPECT_EQ(txid[0], 0x3b);
+
+    EXPECT_FALSE(txref::parseTxid(hex.substr(1)));
+    EXPECT_FALSE(txref::parseTxid("x" + hex.substr(1)));
+}
+
+// check that batch classification lines up with the input and fills in txids
+TEST(TxrefApiTest, classify_batch) {
+    std::vector<std::string> input = {
+            "tx1:rjk0-uqay-z9l7-m9m",
+            "4a5e1e4baab89f3a32518a88c31bc87f618f76673e2cc77ab2127b7afdeda33b",
+            "zz5e1e4baab89f3a32518a88c31bc87f618f76673e2cc77ab2127b7afdeda33b"
+    };
+    std::vector<unsigned char> txids;
+    std::vector<txref::InputParam> results = txref::classifyInputStrings(input, &txids);
+
+    ASSERT_EQ(results.size(), 3u);
+    EXPECT_EQ(results[0], txref::InputParam::txref);
+    EXPECT_EQ(results[1], txref::InputParam::txid);
+    EXPECT_EQ(results[2], txref::InputParam::unknown);
+    ASSERT_EQ(txids.size(), 3u * txref::limits::TXID_SIZE);
+    EXPECT_EQ(txids[0], 0);
+    EXPECT_EQ(txids[txref::limits::TXID_SIZE], 0x3b);
+    EXPECT_EQ(txids[2 * txref::limits::TXID_SIZE - 1], 0x4a);
+    EXPECT_EQ(txids[2 * txref::limits::TXID_SIZE], 0);
+}
+
+// check that huge or separator-heavy inputs are rejected rather than fully processed
+TEST(TxrefApiTest, oversized_input_rejected) {
+    std::string junk(10 * 1024 * 1024, 'q');
+    EXPECT_THROW(txref::decode(junk), std::runtime_error);
+    EXPECT_THROW(txref::normalize(junk), std::runtime_error);
+    EXPECT_EQ(txref::classifyInputString(junk), txref::InputParam::unknown);
+
+    std::string padded = "tx1:rqqq-qqqq-qwtv-vjr" + std::string(txref::limits::TXREF_MAX_SEPARATOR_CHARS, ' ');
+    EXPECT_THROW(txref::decode(padded), std::runtime_error);
+    EXPECT_EQ(txref::classifyInputString(padded), txref::InputParam::unknown);
+
+    // still fine with a reasonable number of separators
+    padded = "tx1:rqqq-qqqq-qwtv-vjr  ";
+    EXPECT_EQ(txref::decode(padded).blockHeight, 0);
+    EXPECT_EQ(txref::classifyInputString(padded), txref::InputParam::txref);
+}
+
 RC_GTEST_PROP(TxrefApiTestRC, checkThatEncodeAndDecodeProduceSameParameters, ()
 ) {
     auto height = *rc::gen::inRange(0, 0xFFFFFF); // MAX_BLOCK_HEIGHT
@@ -492,3 +762,485 @@ RC_GTEST_PROP(TxrefApiTestRC, checkThatExtendedEncodeAndDecodeRegtestProduceSame
     RC_ASSERT(decodedResult.txoIndex == index);
 }
 
+
+namespace {
+    std::vector<unsigned char> fromHex(const std::string & hex) {
+        std::vector<unsigned char> bytes;
+        for(std::size_t i = 0; i + 1 < hex.length(); i += 2)
+            bytes.push_back(static_cast<unsigned char>(std::stoul(hex.substr(i, 2), nullptr, 16)));
+        return bytes;
+    }
+
+    const std::string genesisHeader =
+            "01000000"
+            "0000000000000000000000000000000000000000000000000000000000000000"
+            "3ba3edfd7a7b12b27ac72c3e67768f617fc81bc3888a51323a9fb8aa4b1e5e4a"
+            "29ab5f49ffff001d1dac2b7c";
+
+    const std::string genesisCoinbase =
+            "01000000010000000000000000000000000000000000000000000000000000000000000000ffffffff4d04ffff00"
+            "1d0104455468652054696d65732030332f4a616e2f32303039204368616e63656c6c6f72206f6e206272696e6b"
+            "206f66207365636f6e64206261696c6f757420666f722062616e6b73ffffffff0100f2052a0100000043410467"
+            "8afdb0fe5548271967f1a67130b7105cd6a828e03909a67962e0ea1f61deb649f6bc3f4cef38c4f35504e51ec1"
+            "12de5c384df7ba0b8d578a4c702b6bf11d5fac00000000";
+
+    // one input, two outputs. Same transaction without and with witness data.
+    const std::string txBody =
+            "01" + std::string(64, '1') + "00000000" + "00" + "ffffffff" +
+            "02" + "0100000000000000" + "0151" + "0200000000000000" + "0152";
+    const std::string legacyTx = "02000000" + txBody + "00000000";
+    const std::string segwitTx = "02000000" "0001" + txBody + "01" "02abcd" + "00000000";
+}
+
+// check that txids and txrefs are found in a serialized block
+TEST(TxrefApiTest, encodeBlock_genesis) {
+    auto block = fromHex(genesisHeader + "01" + genesisCoinbase);
+
+    txref::BlockSummary summary = txref::scanBlock(block.data(), block.size());
+    EXPECT_EQ(summary.transactionCount, 1u);
+    EXPECT_EQ(summary.outputCount, 1u);
+
+    txref::BlockTransaction tx;
+    char output[txref::limits::TXREF_BUFFER_SIZE];
+    EXPECT_EQ(txref::encodeBlock(block.data(), block.size(), 0, &tx, 1, output, 1), 1u);
+
+    // the only txid in the block is also its merkle root
+    EXPECT_EQ(std::vector<unsigned char>(tx.txid, tx.txid + txref::limits::TXID_SIZE),
+              std::vector<unsigned char>(block.begin() + 36, block.begin() + 68));
+    unsigned char txid[txref::limits::TXID_SIZE];
+    ASSERT_TRUE(txref::parseTxid("4a5e1e4baab89f3a32518a88c31bc87f618f76673e2cc77ab2127b7afdeda33b", txid));
+    EXPECT_EQ(std::vector<unsigned char>(tx.txid, tx.txid + txref::limits::TXID_SIZE),
+              std::vector<unsigned char>(txid, txid + txref::limits::TXID_SIZE));
+
+    EXPECT_EQ(std::string(tx.txref), txref::encode(0, 0));
+    EXPECT_EQ(tx.outputCount, 1u);
+    EXPECT_EQ(tx.firstOutput, 0u);
+    EXPECT_EQ(std::string(output), txref::encode(0, 0, 0, true));
+}
+
+// check that witness data is skipped when computing txids, and outputs are laid out per transaction
+TEST(TxrefApiTest, encodeBlock_witness) {
+    auto block = fromHex(genesisHeader + "03" + genesisCoinbase + legacyTx + segwitTx);
+
+    txref::BlockSummary summary = txref::scanBlock(block.data(), block.size());
+    EXPECT_EQ(summary.transactionCount, 3u);
+    EXPECT_EQ(summary.outputCount, 5u);
+
+    std::vector<txref::BlockTransaction> txs(summary.transactionCount);
+    std::vector<char> outputs(summary.outputCount * txref::limits::TXREF_BUFFER_SIZE);
+    EXPECT_EQ(txref::encodeBlock(block.data(), block.size(), 1000, txs.data(), txs.size(),
+                                 outputs.data(), summary.outputCount, txref::MAGIC_CODE_TEST,
+                                 txref::Style::compact), 3u);
+
+    EXPECT_EQ(std::vector<unsigned char>(txs[1].txid, txs[1].txid + txref::limits::TXID_SIZE),
+              std::vector<unsigned char>(txs[2].txid, txs[2].txid + txref::limits::TXID_SIZE));
+
+    EXPECT_EQ(std::string(txs[2].txref), txref::normalize(txref::encodeTestnet(1000, 2)));
+    EXPECT_EQ(txs[2].outputCount, 2u);
+    EXPECT_EQ(txs[2].firstOutput, 3u);
+    EXPECT_EQ(std::string(&outputs[4 * txref::limits::TXREF_BUFFER_SIZE]),
+              txref::normalize(txref::encodeTestnet(1000, 2, 1)));
+
+    // txref-exts are optional
+    EXPECT_EQ(txref::encodeBlock(block.data(), block.size(), 1000, txs.data(), txs.size()), 3u);
+    EXPECT_EQ(txs[2].firstOutput, 3u);
+}
+
+// check that malformed blocks and short buffers are rejected
+TEST(TxrefApiTest, encodeBlock_errors) {
+    auto block = fromHex(genesisHeader + "02" + genesisCoinbase + segwitTx);
+    std::vector<txref::BlockTransaction> txs(2);
+    std::vector<char> outputs(3 * txref::limits::TXREF_BUFFER_SIZE);
+
+    EXPECT_THROW(txref::scanBlock(block.data(), block.size() - 1), std::runtime_error);
+    EXPECT_THROW(txref::scanBlock(block.data(), txref::limits::BLOCK_HEADER_SIZE), std::runtime_error);
+    EXPECT_THROW(txref::scanBlock(nullptr, 0), std::runtime_error);
+
+    auto trailing = block;
+    trailing.push_back(0);
+    EXPECT_THROW(txref::scanBlock(trailing.data(), trailing.size()), std::runtime_error);
+
+    EXPECT_THROW(txref::encodeBlock(block.data(), block.size(), 0, txs.data(), 1), std::runtime_error);
+    EXPECT_THROW(txref::encodeBlock(block.data(), block.size(), 0, txs.data(), 2, outputs.data(), 2),
+                 std::runtime_error);
+    EXPECT_THROW(txref::encodeBlock(block.data(), block.size(), 0, txs.data(), 2, nullptr, 0,
+                                    txref::MAGIC_CODE_MAIN_EXTENDED), std::runtime_error);
+    EXPECT_THROW(txref::encodeBlock(block.data(), block.size(), -1, txs.data(), 2), std::runtime_error);
+
+    // a count that claims more transactions than the block could hold
+    auto bogus = fromHex(genesisHeader + "fdffff");
+    EXPECT_THROW(txref::scanBlock(bogus.data(), bogus.size()), std::runtime_error);
+}
+
+namespace {
+    // deterministic pseudo-random txids
+    std::vector<unsigned char> makeTxids(std::size_t count, std::uint64_t seed) {
+        std::vector<unsigned char> txids(count * txref::limits::TXID_SIZE);
+        for(auto & byte : txids) {
+            seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+            byte = static_cast<unsigned char>(seed >> 56u);
+        }
+        return txids;
+    }
+
+    std::vector<std::uint64_t> txidKeys(const std::vector<unsigned char> & txids) {
+        std::vector<std::uint64_t> keys;
+        for(std::size_t i = 0; i < txids.size(); i += txref::limits::TXID_SIZE)
+            keys.push_back(txref::TxFilter::txidKey(&txids[i]));
+        return keys;
+    }
+}
+
+// check that a filter contains every key it was built from, and few others
+TEST(TxrefApiTest, filter_txids) {
+    const std::size_t count = 200000;
+    auto txids = makeTxids(count, 1);
+    auto filter = txref::TxFilter::build(txidKeys(txids));
+    EXPECT_EQ(filter.size(), count);
+
+    for(std::size_t i = 0; i < txids.size(); i += txref::limits::TXID_SIZE)
+        ASSERT_TRUE(filter.mayContainTxid(&txids[i]));
+
+    auto others = makeTxids(count, 2);
+    std::size_t falsePositives = 0;
+    for(std::size_t i = 0; i < others.size(); i += txref::limits::TXID_SIZE)
+        falsePositives += filter.mayContainTxid(&others[i]) ? 1 : 0;
+    EXPECT_LT(falsePositives, count / 100);
+
+    // about 9 bits per key
+    EXPECT_LT(filter.serialize().size() * 8, count * 10);
+}
+
+// check that the number of threads, duplicate keys and key order don't change the filter
+TEST(TxrefApiTest, filter_build_is_deterministic) {
+    auto keys = txidKeys(makeTxids(100000, 3));
+    auto single = txref::TxFilter::build(keys, 1).serialize();
+
+    auto shuffled = keys;
+    shuffled.insert(shuffled.end(), keys.begin(), keys.begin() + 1000);
+    std::reverse(shuffled.begin(), shuffled.end());
+    EXPECT_EQ(txref::TxFilter::build(shuffled, 4).serialize(), single);
+
+    auto same = txref::TxFilter::build(std::vector<std::uint64_t>(1000, 42));
+    EXPECT_EQ(same.size(), 1u);
+    EXPECT_TRUE(same.mayContain(std::uint64_t(42)));
+}
+
+// check lookups of txref strings and txid strings
+TEST(TxrefApiTest, filter_strings) {
+    std::vector<std::uint64_t> keys;
+    for(int i = 0; i < 1000; ++i) {
+        keys.push_back(txref::TxFilter::coordinatesKey(txref::Coordinates(600000 + i, i % 50)));
+        keys.push_back(txref::TxFilter::coordinatesKey(
+                txref::Coordinates(600000 + i, i % 50, 1, txref::MAGIC_CODE_MAIN_EXTENDED)));
+    }
+    std::string txid = "4a5e1e4baab89f3a32518a88c31bc87f618f76673e2cc77ab2127b7afdeda33b";
+    unsigned char txidBytes[txref::limits::TXID_SIZE];
+    ASSERT_TRUE(txref::parseTxid(txid, txidBytes));
+    keys.push_back(txref::TxFilter::txidKey(txidBytes));
+
+    auto filter = txref::TxFilter::build(keys);
+
+    EXPECT_TRUE(filter.mayContain(txid));
+    EXPECT_TRUE(filter.mayContain(txref::encode(600010, 10)));
+    EXPECT_TRUE(filter.mayContain(txref::encodeCompact(600010, 10, 1)));
+    EXPECT_TRUE(filter.mayContain(txref::Coordinates(600999, 49)));
+
+    EXPECT_FALSE(filter.mayContain(""));
+    EXPECT_FALSE(filter.mayContain("not a txref"));
+    EXPECT_FALSE(filter.mayContain("tx1:rqqq-qqqq-qqqq-qqq")); // bad checksum
+
+    std::uint64_t key;
+    ASSERT_TRUE(txref::TxFilter::inputKey("TX1:R52Q-QQPQ-QPTY-CFG", key));
+    EXPECT_EQ(key, txref::TxFilter::coordinatesKey(txref::Coordinates(170, 1)));
+    EXPECT_FALSE(txref::TxFilter::inputKey("1BvBMSEYstWetqTFn5Au4m4GFg7xJaNVN2", key));
+
+    std::size_t falsePositives = 0;
+    for(int i = 0; i < 1000; ++i)
+        falsePositives += filter.mayContain(txref::encodeTestnet(600000 + i, i % 50)) ? 1 : 0;
+    EXPECT_LT(falsePositives, 20u);
+}
+
+// check that a serialized filter can be queried in place, and that bad data is rejected
+TEST(TxrefApiTest, filter_view) {
+    auto txids = makeTxids(5000, 4);
+    auto bytes = txref::TxFilter::build(txidKeys(txids)).serialize();
+
+    auto view = txref::TxFilter::view(bytes.data(), bytes.size());
+    EXPECT_EQ(view.size(), 5000u);
+    for(std::size_t i = 0; i < txids.size(); i += txref::limits::TXID_SIZE)
+        ASSERT_TRUE(view.mayContainTxid(&txids[i]));
+
+    auto copy = view;
+    EXPECT_EQ(copy.serialize(), bytes);
+
+    EXPECT_THROW(txref::TxFilter::view(bytes.data(), bytes.size() - 1), std::runtime_error);
+    EXPECT_THROW(txref::TxFilter::view(bytes.data(), 10), std::runtime_error);
+    EXPECT_THROW(txref::TxFilter::view(nullptr, 0), std::runtime_error);
+    bytes[0] = 'x';
+    EXPECT_THROW(txref::TxFilter::view(bytes.data(), bytes.size()), std::runtime_error);
+
+    txref::TxFilter empty;
+    EXPECT_FALSE(empty.mayContain(txref::Coordinates(0, 0)));
+    auto emptyBytes = txref::TxFilter::build({}).serialize();
+    auto emptyView = txref::TxFilter::view(emptyBytes.data(), emptyBytes.size());
+    EXPECT_EQ(emptyView.size(), 0u);
+    EXPECT_FALSE(emptyView.mayContain(txref::Coordinates(0, 0)));
+
+    // a single key works too
+    auto one = txref::TxFilter::build({txref::TxFilter::coordinatesKey(txref::Coordinates(1, 2))});
+    EXPECT_TRUE(one.mayContain(txref::Coordinates(1, 2)));
+}
+
+namespace {
+    const std::string block1Header =
+            "010000006fe28c0ab6f1b372c1a6a246ae63f74f931e8365e15a089c68d6190000000000982051fd1e4ba744bbbe680e1f"
+            "ee14677ba1a3c3540bf7b1cdb606e857233e0e61bc6649ffff001d01e36299";
+}
+
+// check that block times are indexed by height, from ordered or unordered headers
+TEST(TxrefApiTest, blockTimeIndex_fromHeaders) {
+    auto headers = fromHex(genesisHeader + block1Header);
+
+    auto index = txref::BlockTimeIndex::fromHeaders(headers.data(), 2);
+    EXPECT_EQ(index.size(), 2u);
+    EXPECT_EQ(index.blockTime(0), 1231006505u);
+    EXPECT_EQ(index.blockTime(1), 1231469665u);
+    EXPECT_EQ(index.medianTimePast(1), 1231469665u); // median of 2 values is the later one
+    EXPECT_THROW(index.blockTime(2), std::runtime_error);
+    EXPECT_THROW(index.blockTime(-1), std::runtime_error);
+
+    auto reversed = fromHex(block1Header + genesisHeader);
+    auto unordered = txref::BlockTimeIndex::fromUnorderedHeaders(reversed.data(), 2);
+    EXPECT_EQ(unordered.serialize(), index.serialize());
+
+    // block 1 can't come first, and block 1 alone has no genesis block
+    EXPECT_THROW(txref::BlockTimeIndex::fromHeaders(reversed.data(), 2), std::runtime_error);
+    EXPECT_THROW(txref::BlockTimeIndex::fromUnorderedHeaders(reversed.data(), 1), std::runtime_error);
+    EXPECT_THROW(txref::BlockTimeIndex::fromHeaders(headers.data(), 2, txref::MAGIC_CODE_MAIN_EXTENDED),
+                 std::runtime_error);
+}
+
+// check time range queries, decode enrichment, and a saved index
+TEST(TxrefApiTest, blockTimeIndex_queries) {
+    auto headers = fromHex(genesisHeader + block1Header);
+    auto bytes = txref::BlockTimeIndex::fromHeaders(headers.data(), 2).serialize();
+    auto index = txref::BlockTimeIndex::view(bytes.data(), bytes.size());
+
+    EXPECT_EQ(index.heightRange(0, 1231006505), std::make_pair(0, 0));
+    EXPECT_EQ(index.heightRange(1231006505, 1231006506), std::make_pair(0, 1));
+    EXPECT_EQ(index.heightRange(1231006506, 1231469666), std::make_pair(1, 2));
+    EXPECT_EQ(index.heightRange(1231469666, 2000000000), std::make_pair(2, 2));
+    EXPECT_EQ(index.heightRangeByMedianTime(0, 2000000000), std::make_pair(0, 2));
+
+    auto result = txref::decode(txref::encode(1, 0), index);
+    EXPECT_EQ(result.blockTime, 1231469665u);
+    EXPECT_EQ(result.medianTimePast, 1231469665u);
+    result = txref::decode(txref::encode(1, 0, 1), index);
+    EXPECT_EQ(result.blockTime, 1231469665u);
+
+    // other networks and unknown heights are left alone
+    EXPECT_EQ(txref::decode(txref::encodeTestnet(1, 0), index).blockTime, 0u);
+    EXPECT_EQ(txref::decode(txref::encode(2, 0), index).blockTime, 0u);
+
+    EXPECT_THROW(txref::BlockTimeIndex::view(bytes.data(), bytes.size() - 1), std::runtime_error);
+    EXPECT_THROW(txref::BlockTimeIndex::view(nullptr, 0), std::runtime_error);
+
+    txref::BlockTimeIndex empty;
+    EXPECT_EQ(empty.heightRange(0, 2000000000), std::make_pair(0, 0));
+    auto emptyBytes = empty.serialize();
+    EXPECT_EQ(txref::BlockTimeIndex::view(emptyBytes.data(), emptyBytes.size()).size(), 0u);
+}
+
+TEST(TxrefApiTest, aggregator_groups) {
+    txref::TxrefAggregator aggregator(1000);
+    EXPECT_TRUE(aggregator.add(txref::encode(0, 0)));
+    EXPECT_TRUE(aggregator.add(std::string("TX1:RQQQ-QQQQ-QWTV-VJR")));   // the same txref again
+    EXPECT_TRUE(aggregator.add(txref::encode(999, 7)));
+    EXPECT_TRUE(aggregator.add(txref::encodeTestnet(5, 1)));
+    EXPECT_TRUE(aggregator.add(txref::encode(1500, 2, 3)));
+    EXPECT_TRUE(aggregator.add(txref::encode(1500, 2, 0, true)));
+    EXPECT_TRUE(aggregator.add(txref::encode(1999, 4, 300)));
+    aggregator.add(txref::Coordinates(1200, 9));
+    EXPECT_FALSE(aggregator.add(std::string("tx1:rqqq-qqqq-qwtv-vjq")));
+    EXPECT_FALSE(aggregator.add(nullptr, 0));
+    EXPECT_EQ(aggregator.invalidCount(), 2u);
+    EXPECT_EQ(aggregator.bucketSize(), 1000);
+
+    auto groups = aggregator.groups();
+    ASSERT_EQ(groups.size(), 4u);
+
+    EXPECT_EQ(groups[0].firstHeight, 0);
+    EXPECT_EQ(groups[0].magicCode, txref::MAGIC_CODE_MAIN);
+    EXPECT_FALSE(groups[0].extended);
+    EXPECT_EQ(groups[0].count, 3u);
+    EXPECT_EQ(groups[0].distinctTransactions, 2u);
+    EXPECT_EQ(groups[0].distinctOutputs, 0u);
+    EXPECT_EQ(groups[0].minHeight, 0);
+    EXPECT_EQ(groups[0].maxHeight, 999);
+    EXPECT_EQ(groups[0].maxTransactionIndex, 7);
+
+    EXPECT_EQ(groups[1].firstHeight, 0);
+    EXPECT_EQ(groups[1].magicCode, txref::MAGIC_CODE_TEST);
+    EXPECT_EQ(groups[1].count, 1u);
+
+    EXPECT_EQ(groups[2].firstHeight, 1000);
+    EXPECT_FALSE(groups[2].extended);
+    EXPECT_EQ(groups[2].count, 1u);
+    EXPECT_EQ(groups[2].minHeight, 1200);
+
+    EXPECT_EQ(groups[3].firstHeight, 1000);
+    EXPECT_EQ(groups[3].magicCode, txref::MAGIC_CODE_MAIN);
+    EXPECT_TRUE(groups[3].extended);
+    EXPECT_EQ(groups[3].count, 3u);
+    EXPECT_EQ(groups[3].distinctTransactions, 2u);
+    EXPECT_EQ(groups[3].distinctOutputs, 3u);
+    EXPECT_EQ(groups[3].minTxoIndex, 0);
+    EXPECT_EQ(groups[3].maxTxoIndex, 300);
+    EXPECT_EQ(groups[3].txoHistogram[0], 1u);
+    EXPECT_EQ(groups[3].txoHistogram[2], 1u);   // 3
+    EXPECT_EQ(groups[3].txoHistogram[9], 1u);   // 300
+}
+
+TEST(TxrefApiTest, aggregator_merge) {
+    txref::TxrefAggregator all(100), even(100), odd(100);
+    for(int i = 0; i < 20000; ++i) {
+        txref::Coordinates coordinates(i % 700, i % 3000, i % 5, txref::MAGIC_CODE_MAIN_EXTENDED);
+        all.add(coordinates);
+        (i % 2 == 0 ? even : odd).add(coordinates);
+    }
+    odd.add(std::string("not a txref"));
+    all.add(std::string("not a txref"));
+    even.merge(odd);
+
+    auto expected = all.groups();
+    auto merged = even.groups();
+    ASSERT_EQ(merged.size(), expected.size());
+    for(std::size_t i = 0; i < merged.size(); ++i) {
+        EXPECT_EQ(merged[i].firstHeight, expected[i].firstHeight);
+        EXPECT_EQ(merged[i].count, expected[i].count);
+        EXPECT_EQ(merged[i].distinctTransactions, expected[i].distinctTransactions);
+        EXPECT_EQ(merged[i].distinctOutputs, expected[i].distinctOutputs);
+        EXPECT_EQ(merged[i].minHeight, expected[i].minHeight);
+        EXPECT_EQ(merged[i].maxTransactionIndex, expected[i].maxTransactionIndex);
+        EXPECT_TRUE(std::equal(merged[i].txoHistogram, merged[i].txoHistogram + 16, expected[i].txoHistogram));
+    }
+    EXPECT_EQ(even.invalidCount(), 1u);
+
+    txref::TxrefAggregator other(10);
+    EXPECT_THROW(even.merge(other), std::runtime_error);
+}
+
+TEST(TxrefApiTest, aggregator_distinct_estimate) {
+    txref::TxrefAggregator aggregator(1000000);
+    const int distinct = 200000;
+    for(int repeat = 0; repeat < 2; ++repeat) {
+        for(int i = 0; i < distinct; ++i)
+            aggregator.add(txref::Coordinates(i / 1000, i % 1000));
+    }
+    auto groups = aggregator.groups();
+    ASSERT_EQ(groups.size(), 1u);
+    EXPECT_EQ(groups[0].count, 2u * distinct);
+    EXPECT_NEAR(static_cast<double>(groups[0].distinctTransactions), distinct, distinct * 0.05);
+}
+
+TEST(TxrefApiTest, aggregator_errors) {
+    EXPECT_THROW(txref::TxrefAggregator(0), std::runtime_error);
+    txref::TxrefAggregator aggregator;
+    EXPECT_THROW(aggregator.add(txref::Coordinates(0x1000000, 0)), std::runtime_error);
+    EXPECT_THROW(aggregator.add(txref::Coordinates(1, 0, 1, txref::MAGIC_CODE_MAIN)), std::runtime_error);
+    EXPECT_TRUE(aggregator.groups().empty());
+
+    txref::TxrefAggregator moved(std::move(aggregator));
+    EXPECT_EQ(moved.bucketSize(), 1);
+}
+
+#if defined(__unix__) || defined(__APPLE__)
+// writes a file of txrefs, with some lines that aren't, and returns what decodeFile() should find
+std::vector<txref::DecodedLine> writeTxrefFile(const std::string & path) {
+    std::vector<txref::DecodedLine> expected;
+    std::ofstream out(path, std::ios::binary);
+    for(int i = 0; i < 5000; ++i) {
+        txref::DecodedLine line;
+        if(i % 997 == 5) {
+            out << (i % 2 == 0 ? "\n" : "not a txref\n");
+        }
+        else if(i == 1234) {
+            out << std::string(10000, 'q') << "\n";   // spans several reads
+        }
+        else {
+            line.coordinates = txref::Coordinates(i * 37, i % 3000, i % 3 == 0 ? i % 50 : 0,
+                                                  i % 3 == 0 ? txref::MAGIC_CODE_TEST_EXTENDED : txref::MAGIC_CODE_TEST);
+            line.valid = true;
+            out << line.coordinates << (i % 10 == 0 ? "\r\n" : "\n");
+        }
+        expected.push_back(line);
+    }
+    // a last line without a newline
+    txref::DecodedLine last;
+    last.coordinates = txref::Coordinates(1, 2);
+    last.valid = true;
+    out << last.coordinates;
+    expected.push_back(last);
+    return expected;
+}
+
+TEST(TxrefApiTest, decodeFile_lines) {
+    const std::string path = "decodeFile_lines.txt";
+    auto expected = writeTxrefFile(path);
+
+    for(int variant = 0; variant < 4; ++variant) {
+        txref::FileDecodeOptions options;
+        options.readSize = 4096;
+        options.threads = variant % 2 == 0 ? 1 : 3;
+        options.ioUring = variant < 2;
+        options.directIo = variant == 1;
+
+        std::vector<txref::DecodedLine> lines;
+        auto stats = txref::decodeFile(path, [&](std::uint64_t firstLine, const txref::DecodedLine * decoded, std::size_t count) {
+            EXPECT_EQ(firstLine, lines.size());
+            lines.insert(lines.end(), decoded, decoded + count);
+        }, options);
+
+        ASSERT_EQ(lines.size(), expected.size());
+        for(std::size_t i = 0; i < lines.size(); ++i) {
+            EXPECT_EQ(lines[i].valid, expected[i].valid) << "line " << i;
+            EXPECT_EQ(lines[i].coordinates.blockHeight, expected[i].coordinates.blockHeight) << "line " << i;
+            EXPECT_EQ(lines[i].coordinates.transactionIndex, expected[i].coordinates.transactionIndex);
+            EXPECT_EQ(lines[i].coordinates.txoIndex, expected[i].coordinates.txoIndex);
+            EXPECT_EQ(lines[i].coordinates.magicCode, expected[i].coordinates.magicCode);
+        }
+        EXPECT_EQ(stats.lines, expected.size());
+        EXPECT_EQ(stats.invalidLines, 7u);
+        if(!options.ioUring) {
+            EXPECT_FALSE(stats.usedIoUring);
+        }
+    }
+    std::remove(path.c_str());
+}
+
+TEST(TxrefApiTest, decodeFile_errors) {
+    const std::string path = "decodeFile_errors.txt";
+    writeTxrefFile(path);
+
+    txref::FileDecodeOptions options;
+    options.readSize = 4096;
+    int calls = 0;
+    EXPECT_THROW(txref::decodeFile(path, [&](std::uint64_t, const txref::DecodedLine *, std::size_t) {
+        if(++calls == 3)
+            throw std::runtime_error("stop");
+    }, options), std::runtime_error);
+    EXPECT_EQ(calls, 3);
+    std::remove(path.c_str());
+
+    EXPECT_THROW(txref::decodeFile("no such file", [](std::uint64_t, const txref::DecodedLine *, std::size_t) {}),
+                 std::runtime_error);
+
+    std::ofstream(path).close();
+    auto stats = txref::decodeFile(path, [](std::uint64_t, const txref::DecodedLine *, std::size_t) {
+        FAIL() << "an empty file has no lines";
+    });
+    EXPECT_EQ(stats.lines, 0u);
+    std::remove(path.c_str());
+}
+#endif
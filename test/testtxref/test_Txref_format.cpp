@@ -0,0 +1,105 @@
+#pragma ide diagnostic ignored "cert-err58-cpp"
+#include <gtest/gtest.h>
+
+// the formatter specializations are only declared when <format> or {fmt} is available,
+// and {fmt} must be included before libtxref.h
+#ifdef TXREF_TEST_FMT
+#include <fmt/format.h>
+#endif
+#include "libtxref.h"
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <string>
+
+// In this file, we check the std::format and {fmt} formatters for txref::Coordinates,
+// which need a newer C++ standard than the rest of the tests.
+
+namespace {
+    std::atomic<std::size_t> allocations(0);
+}
+
+// count heap allocations, so the formatters can be checked not to make any
+void * operator new(std::size_t size) {
+    ++allocations;
+    if(void * p = std::malloc(size == 0 ? 1 : size))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void * p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void * p, std::size_t) noexcept {
+    std::free(p);
+}
+
+namespace {
+    const txref::Coordinates mainnet(466793, 2205);
+    const txref::Coordinates extended(10000, 2, 3, txref::MAGIC_CODE_MAIN_EXTENDED);
+}
+
+#ifdef __cpp_lib_format
+// check that the format specs select the style and case
+TEST(TxrefFormatTest, std_format_specs) {
+    EXPECT_EQ(std::format("{}", mainnet), "tx1:rjk0-uqay-z9l7-m9m");
+    EXPECT_EQ(std::format("{:p}", mainnet), "tx1:rjk0-uqay-z9l7-m9m");
+    EXPECT_EQ(std::format("{:c}", mainnet), "tx1rjk0uqayz9l7m9m");
+    EXPECT_EQ(std::format("{:u}", mainnet), "TX1:RJK0-UQAY-Z9L7-M9M");
+    EXPECT_EQ(std::format("{:cu}", extended), "TX1YQ3NQQZQQRQQ9Z4D2N");
+    EXPECT_EQ(std::format("[{}] [{:c}]", mainnet, extended), "[tx1:rjk0-uqay-z9l7-m9m] [tx1yq3nqqzqqrqq9z4d2n]");
+
+    EXPECT_THROW(static_cast<void>(std::vformat("{:x}", std::make_format_args(mainnet))), std::format_error);
+    EXPECT_THROW(static_cast<void>(std::format("{}", txref::Coordinates(-1, 0))), std::runtime_error);
+}
+
+// check that formatting into a caller's buffer doesn't allocate
+TEST(TxrefFormatTest, std_format_doesNotAllocate) {
+    char buffer[64];
+    std::size_t before = allocations;
+    auto result = std::format_to_n(buffer, sizeof(buffer), "{:cu} {}", mainnet, extended);
+    std::size_t after = allocations;
+    EXPECT_EQ(after, before);
+    EXPECT_EQ(std::string(buffer, result.out), "TX1RJK0UQAYZ9L7M9M tx1:yq3n-qqzq-qrqq-9z4d-2n");
+
+    // while a std::string that long does allocate, which shows allocations are counted
+    std::string formatted = std::format("{}", extended);
+    EXPECT_GT(allocations, after);
+}
+#endif // #ifdef __cpp_lib_format
+
+#ifdef TXREF_TEST_FMT
+// check that the format specs select the style and case
+TEST(TxrefFormatTest, fmt_format_specs) {
+    EXPECT_EQ(fmt::format("{}", mainnet), "tx1:rjk0-uqay-z9l7-m9m");
+    EXPECT_EQ(fmt::format("{:p}", mainnet), "tx1:rjk0-uqay-z9l7-m9m");
+    EXPECT_EQ(fmt::format("{:c}", mainnet), "tx1rjk0uqayz9l7m9m");
+    EXPECT_EQ(fmt::format("{:u}", mainnet), "TX1:RJK0-UQAY-Z9L7-M9M");
+    EXPECT_EQ(fmt::format("{:cu}", extended), "TX1YQ3NQQZQQRQQ9Z4D2N");
+    EXPECT_EQ(fmt::format("[{}] [{:c}]", mainnet, extended), "[tx1:rjk0-uqay-z9l7-m9m] [tx1yq3nqqzqqrqq9z4d2n]");
+
+    EXPECT_THROW(static_cast<void>(fmt::format(fmt::runtime("{:x}"), mainnet)), fmt::format_error);
+    EXPECT_THROW(static_cast<void>(fmt::format("{}", txref::Coordinates(-1, 0))), std::runtime_error);
+}
+
+// check that formatting into a caller's buffer doesn't allocate
+TEST(TxrefFormatTest, fmt_format_doesNotAllocate) {
+    char buffer[64];
+    std::size_t before = allocations;
+    auto result = fmt::format_to_n(buffer, sizeof(buffer), "{:cu} {}", mainnet, extended);
+    std::size_t after = allocations;
+    EXPECT_EQ(after, before);
+    EXPECT_EQ(std::string(buffer, result.out), "TX1RJK0UQAYZ9L7M9M tx1:yq3n-qqzq-qrqq-9z4d-2n");
+
+    // while a std::string that long does allocate, which shows allocations are counted
+    std::string formatted = fmt::format("{}", extended);
+    EXPECT_GT(allocations, after);
+}
+#endif // #ifdef TXREF_TEST_FMT
+
+#if !defined(__cpp_lib_format) && !defined(TXREF_TEST_FMT)
+TEST(TxrefFormatTest, noFormatterAvailable) {
+    GTEST_SKIP() << "neither <format> nor {fmt} is available";
+}
+#endif
@@ -1,5 +1,9 @@
 // test program calling txref library from C
 
+#if defined(__unix__) || defined(__APPLE__)
+#define _POSIX_C_SOURCE 200809L
+#include <poll.h>
+#endif
 #include <string.h>
 #include <stdlib.h>
 #include <stdbool.h>
@@ -286,6 +290,18 @@ void decode_whenMethodThrowsException_isUnsuccessful() {
     txref_free_DecodedResult(decodedResult);
 }
 
+void decode_withOversizedInput_isUnsuccessful() {
+    size_t length = 1024 * 1024;
+    char * txref = (char *)malloc(length + 1);
+    memset(txref, 'q', length);
+    txref[length] = '\0';
+
+    txref_DecodedResult *decodedResult = txref_create_DecodedResult();
+    assert(txref_decode(decodedResult, txref) == E_TXREF_UNKNOWN_ERROR);
+    txref_free_DecodedResult(decodedResult);
+    free(txref);
+}
+
 void decode_mainnetExamples_areSuccessful() {
     char hrp[] = "tx";
 
@@ -489,6 +505,154 @@ void decode_withOriginalChecksumConstant_hasCommentary() {
     txref_free_DecodedResult(decodedResult);
 }
 
+typedef struct jobSummary_s {
+    int calls;
+    uint64_t jobId;
+    size_t failures;
+} jobSummary;
+
+static void recordJob(uint64_t jobId, size_t failures, void * userData) {
+    jobSummary * summary = (jobSummary *)userData;
+    summary->calls++;
+    summary->jobId = jobId;
+    summary->failures = failures;
+}
+
+void context_withBadArgs_isUnsuccessful() {
+    txref_coordinates coordinates = {0, 0, 0, 3};
+    char output[TXREF_C_BUFFER_SIZE];
+    txref_error error;
+    txref_context * context = txref_create_context(1);
+    assert(context != NULL);
+
+    assert(txref_submit_encode(NULL, &coordinates, 1, false, output, &error, NULL, NULL, NULL) == E_TXREF_NULL_ARGUMENT);
+    assert(txref_submit_encode(context, NULL, 1, false, output, &error, NULL, NULL, NULL) == E_TXREF_NULL_ARGUMENT);
+    assert(txref_submit_encode(context, &coordinates, 1, false, NULL, &error, NULL, NULL, NULL) == E_TXREF_NULL_ARGUMENT);
+    assert(txref_submit_decode(context, NULL, 1, &coordinates, &error, NULL, NULL, NULL) == E_TXREF_NULL_ARGUMENT);
+    assert(txref_completed_jobs(NULL, NULL, 0) == 0);
+    assert(strcmp(txref_strerror(E_TXREF_INVALID_ARGUMENT), "Function argument was invalid") == 0);
+
+    txref_free_context(context);
+    txref_free_context(NULL);
+}
+
+void context_encodeAndDecode_withCallback_areSuccessful() {
+    const size_t count = 5000;
+    txref_coordinates * inputs = (txref_coordinates *)calloc(count, sizeof(txref_coordinates));
+    char * txrefs = (char *)calloc(count, TXREF_C_BUFFER_SIZE);
+    const char ** txrefPointers = (const char **)calloc(count, sizeof(char *));
+    txref_coordinates * decoded = (txref_coordinates *)calloc(count, sizeof(txref_coordinates));
+    txref_error * errors = (txref_error *)calloc(count, sizeof(txref_error));
+    jobSummary encodeSummary = {0, 0, 0};
+    jobSummary decodeSummary = {0, 0, 0};
+    uint64_t encodeId = 0;
+    uint64_t decodeId = 0;
+
+    for(size_t i = 0; i < count; ++i) {
+        inputs[i].blockHeight = (int)(i * 97);
+        inputs[i].transactionIndex = (int)(i % 1000);
+        inputs[i].txoIndex = (i % 2 == 0) ? 0 : (int)(i % 300);
+        inputs[i].magicCode = (i % 2 == 0) ? 0x3 : 0x7;
+    }
+    inputs[42].blockHeight = 0x1000000; // out of range
+
+    txref_context * context = txref_create_context(4);
+    assert(context != NULL);
+    assert(txref_submit_encode(context, inputs, count, false, txrefs, errors, recordJob, &encodeSummary, &encodeId) == E_TXREF_SUCCESS);
+    // freeing the context waits for the job to finish
+    txref_free_context(context);
+
+    assert(encodeSummary.calls == 1);
+    assert(encodeSummary.jobId == encodeId);
+    assert(encodeSummary.failures == 1);
+    assert(errors[42] == E_TXREF_INVALID_ARGUMENT);
+    assert(txrefs[42 * TXREF_C_BUFFER_SIZE] == '\0');
+    assert(strcmp(txrefs, "tx1:rqqq-qqqq-qwtv-vjr") == 0);
+    {
+        txref_tstring * tstring = txref_create_tstring();
+        assert(txref_encodeTestnet(tstring, 97, 1, 1, true, "txtest") == E_TXREF_SUCCESS);
+        assert(strcmp(txrefs + TXREF_C_BUFFER_SIZE, tstring->string) == 0);
+        txref_free_tstring(tstring);
+    }
+
+    for(size_t i = 0; i < count; ++i)
+        txrefPointers[i] = txrefs + i * TXREF_C_BUFFER_SIZE;
+    txrefPointers[7] = NULL;
+
+    context = txref_create_context(0);
+    assert(context != NULL);
+    assert(txref_submit_decode(context, txrefPointers, count, decoded, errors, recordJob, &decodeSummary, &decodeId) == E_TXREF_SUCCESS);
+    txref_free_context(context);
+
+    assert(decodeSummary.calls == 1);
+    assert(decodeSummary.failures == 2);
+    assert(errors[7] == E_TXREF_NULL_ARGUMENT);
+    assert(errors[42] == E_TXREF_INVALID_ARGUMENT);
+    for(size_t i = 0; i < count; ++i) {
+        if(i == 7 || i == 42)
+            continue;
+        assert(errors[i] == E_TXREF_SUCCESS);
+        assert(decoded[i].blockHeight == inputs[i].blockHeight);
+        assert(decoded[i].transactionIndex == inputs[i].transactionIndex);
+        assert(decoded[i].txoIndex == inputs[i].txoIndex);
+        assert(decoded[i].magicCode == inputs[i].magicCode);
+    }
+
+    free(inputs);
+    free(txrefs);
+    free(txrefPointers);
+    free(decoded);
+    free(errors);
+}
+
+void context_jobsWithoutCallback_areCompleted() {
+    const char * txrefs[2] = {"tx1:rqqq-qqqq-qwtv-vjr", "txtest1:xk63-uqnf-zgve-zdz"};
+    txref_coordinates decoded[2];
+    txref_error errors[2];
+    txref_job_result results[4];
+    uint64_t decodeId = 0;
+    uint64_t emptyId = 0;
+    size_t found = 0;
+    int seenDecode = 0;
+    int seenEmpty = 0;
+
+    txref_context * context = txref_create_context(2);
+    assert(context != NULL);
+    assert(txref_submit_decode(context, txrefs, 2, decoded, errors, NULL, &seenDecode, &decodeId) == E_TXREF_SUCCESS);
+    assert(txref_submit_encode(context, NULL, 0, true, NULL, NULL, NULL, &seenEmpty, &emptyId) == E_TXREF_SUCCESS);
+    assert(decodeId != emptyId);
+
+    while(found < 2) {
+#if defined(__unix__) || defined(__APPLE__)
+        struct pollfd pfd;
+        pfd.fd = txref_context_fd(context);
+        pfd.events = POLLIN;
+        assert(pfd.fd >= 0);
+        assert(poll(&pfd, 1, 10000) == 1);
+#endif
+        size_t n = txref_completed_jobs(context, results, 1);
+        for(size_t i = 0; i < n; ++i) {
+            if(results[i].jobId == decodeId) {
+                assert(results[i].userData == &seenDecode);
+                assert(results[i].failures == 0);
+                seenDecode = 1;
+            }
+            else {
+                assert(results[i].jobId == emptyId);
+                assert(results[i].failures == 0);
+                seenEmpty = 1;
+            }
+        }
+        found += n;
+    }
+    assert(seenDecode && seenEmpty);
+    assert(decoded[0].magicCode == 0x3 && decoded[0].blockHeight == 0);
+    assert(decoded[1].magicCode == 0x6 && decoded[1].blockHeight == 467883 && decoded[1].transactionIndex == 2355);
+    assert(txref_completed_jobs(context, results, 4) == 0);
+
+    txref_free_context(context);
+}
+
 int main() {
 
     strerror_withValidErrorCode_returnsErrorMessage();
@@ -505,6 +669,7 @@ int main() {
 
     decode_withBadArgs_isUnsuccessful();
     decode_whenMethodThrowsException_isUnsuccessful();
+    decode_withOversizedInput_isUnsuccessful();
     decode_mainnetExamples_areSuccessful();
     decode_mainnetExtendedExamples_areSuccessful();
     decode_testnetExamples_areSuccessful();
@@ -513,5 +678,9 @@ int main() {
     decode_regtestExtendedExamples_areSuccessful();
     decode_withOriginalChecksumConstant_hasCommentary();
 
+    context_withBadArgs_isUnsuccessful();
+    context_encodeAndDecode_withCallback_areSuccessful();
+    context_jobsWithoutCallback_areCompleted();
+
     return 0;
 }